@@ -148,6 +148,17 @@
                    }; \
                  }
 
+/* QMALLOC64() needs _POSIX_C_SOURCE >= 200112L for posix_memalign() */
+#define	QMALLOC64(ptr, typ, nel) \
+		{if (posix_memalign((void **)&ptr, 64, (size_t)(nel)*sizeof(typ)))\
+		   { \
+		   sprintf(gstr, #ptr " (" #nel "=%lld elements) " \
+			"at line %d in module " __FILE__ " !", \
+			(size_t)(nel)*sizeof(typ), __LINE__); \
+		   error(EXIT_FAILURE, "Could not allocate memory for ", gstr);\
+                   }; \
+                 }
+
 #define	QREALLOC(ptr, typ, nel) \
 		{if (!(ptr = (typ *)realloc(ptr, (size_t)(nel)*sizeof(typ))))\
 		   { \
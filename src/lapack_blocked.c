@@ -0,0 +1,633 @@
+/*
+ This code provides the functions declared in lapack_stub.h with in-tree,
+ cache-blocked implementations that do not depend on any external linear
+ algebra library. It is selected with -DPSFEX_LAPACK_BACKEND=INTERNAL at
+ configure time. All arguments are honoured, with the usual column-major
+ LAPACK conventions.
+
+ The matrices are processed by panels of LAPACK_NB columns. The bulk of the
+ work (the trailing updates) is split into independent tiles which, if
+ multithreading is enabled, are distributed over prefs.nthreads threads. Tiles
+ are assigned to threads in a fixed order, and each tile is always computed
+ the same way, so results do not depend on the number of threads.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include	"config.h"
+#endif
+
+#ifdef USE_THREADS
+#include	<pthread.h>
+#endif
+#include	<math.h>
+#include	<stdio.h>
+#include	<stdlib.h>
+
+#include	"define.h"
+#include	"types.h"
+#include	"globals.h"
+#include	"fits/fitscat.h"
+#include	"prefs.h"
+#include	"lapack_stub.h"
+#ifdef USE_THREADS
+#include	"threads.h"
+#endif
+
+#define	LAPACK_NB	64	// Panel width (columns or packed rows)
+#define	LAPACK_MINPAR	256	// Min. order for running the updates in parallel
+
+typedef struct
+{
+	void	(*func)(void *, int);	// Function processing one task
+	void	*arg;			// Task arguments
+	int	ntask;			// Number of tasks
+	int	proc;			// Thread number
+	int	nproc;			// Number of threads
+} lapacktaskstruct;
+
+typedef struct
+{
+	double	*a;		// Matrix
+	long	lda;		// Leading dimension
+	long	n;		// Order of the matrix
+	long	k0, k1;		// Current panel
+	int	nblock;		// Number of trailing blocks per side
+} lapacktilestruct;
+
+/*
+ Run ntask independent tasks, over several threads if multithreading is
+ enabled and the problem is large enough.
+*/
+#ifdef USE_THREADS
+static void *lapack_taskthread(void *arg)
+{
+	lapacktaskstruct *task = (lapacktaskstruct *)arg;
+	int t;
+
+	for (t = task->proc; t < task->ntask; t += task->nproc)
+		task->func(task->arg, t);
+
+	pthread_exit(NULL);
+	return (void *)NULL;
+}
+#endif
+
+static void lapack_run(void (*func)(void *, int), void *arg, int ntask, long n)
+{
+	int t;
+#ifdef USE_THREADS
+	pthread_attr_t pthread_attr;
+	pthread_t *thread;
+	lapacktaskstruct *task;
+	int p, nproc;
+
+	nproc = prefs.nthreads < ntask ? prefs.nthreads : ntask;
+	if (nproc > 1 && n >= LAPACK_MINPAR)
+	{
+		QMALLOC(thread, pthread_t, nproc);
+		QMALLOC(task, lapacktaskstruct, nproc);
+		QPTHREAD_ATTR_INIT(&pthread_attr);
+		QPTHREAD_ATTR_SETDETACHSTATE(&pthread_attr, PTHREAD_CREATE_JOINABLE);
+		for (p = 0; p < nproc; p++)
+		{
+			task[p].func = func;
+			task[p].arg = arg;
+			task[p].ntask = ntask;
+			task[p].proc = p;
+			task[p].nproc = nproc;
+			QPTHREAD_CREATE(&thread[p], &pthread_attr, &lapack_taskthread, &task[p]);
+		}
+		for (p = 0; p < nproc; p++)
+			QPTHREAD_JOIN(thread[p], NULL);
+		QPTHREAD_ATTR_DESTROY(&pthread_attr);
+		free(task);
+		free(thread);
+		return;
+	}
+#endif
+	for (t = 0; t < ntask; t++)
+		func(arg, t);
+
+	return;
+}
+
+
+/*
+ Swap the strict upper and lower triangles of a square column-major matrix.
+ 'U' requests are turned into 'L' requests this way, which keeps a single
+ (fast) code path while leaving the other triangle untouched on exit.
+*/
+static void lapack_swaptri(double *a, long n, long lda)
+{
+	double val;
+	long i, j;
+
+	for (j = 0; j < n; j++)
+		for (i = j+1; i < n; i++)
+		{
+			val = a[i+j*lda];
+			a[i+j*lda] = a[j+i*lda];
+			a[j+i*lda] = val;
+		}
+
+	return;
+}
+
+
+/*
+ Trailing update of the Cholesky factorisation for one tile:
+ A(rows,cols) -= A(rows,k0:k1).A(cols,k0:k1)**T for the lower triangle.
+ Tasks enumerate the (row block >= column block) tiles.
+*/
+static void lapack_potrf_tile(void *arg, int task)
+{
+	lapacktilestruct *tile = (lapacktilestruct *)arg;
+	double *a = tile->a, *col, *col2, *p0, *p1, *p2, *p3,
+		f0, f1, f2, f3, g0, g1;
+	long lda = tile->lda, k0 = tile->k0, k1 = tile->k1, n = tile->n,
+		r0, r1, c0, c1, c, i, i0, p;
+	int rb, cb;
+
+	for (cb = 0; task >= tile->nblock - cb; cb++)
+		task -= tile->nblock - cb;
+	rb = cb + task;
+	c0 = k1 + (long)cb*LAPACK_NB;
+	c1 = (c0 + LAPACK_NB < n) ? c0 + LAPACK_NB : n;
+	r0 = k1 + (long)rb*LAPACK_NB;
+	r1 = (r0 + LAPACK_NB < n) ? r0 + LAPACK_NB : n;
+	for (c = c0; c+1 < c1; c += 2)
+	{
+		// Two columns at a time, sharing the loads of the panel
+		col = a + c*lda;
+		col2 = col + lda;
+		i0 = (c+1 > r0) ? c+1 : r0;
+		if (c >= r0)
+			for (p = k0; p < k1; p++)
+				col[c] -= a[c+p*lda]*a[c+p*lda];
+		for (p = k0; p+1 < k1; p += 2)
+		{
+			p0 = a + p*lda;
+			p1 = p0 + lda;
+			f0 = p0[c];
+			f1 = p1[c];
+			g0 = p0[c+1];
+			g1 = p1[c+1];
+			for (i = i0; i < r1; i++)
+			{
+				col[i] -= f0*p0[i] + f1*p1[i];
+				col2[i] -= g0*p0[i] + g1*p1[i];
+			}
+		}
+		for (; p < k1; p++)
+		{
+			p0 = a + p*lda;
+			f0 = p0[c];
+			g0 = p0[c+1];
+			for (i = i0; i < r1; i++)
+			{
+				col[i] -= f0*p0[i];
+				col2[i] -= g0*p0[i];
+			}
+		}
+	}
+	for (; c < c1; c++)
+	{
+		col = a + c*lda;
+		i0 = (c > r0) ? c : r0;
+		for (p = k0; p+3 < k1; p += 4)
+		{
+			p0 = a + p*lda;
+			p1 = p0 + lda;
+			p2 = p1 + lda;
+			p3 = p2 + lda;
+			f0 = p0[c];
+			f1 = p1[c];
+			f2 = p2[c];
+			f3 = p3[c];
+			for (i = i0; i < r1; i++)
+				col[i] -= f0*p0[i] + f1*p1[i] + f2*p2[i] + f3*p3[i];
+		}
+		for (; p < k1; p++)
+		{
+			p0 = a + p*lda;
+			f0 = p0[c];
+			for (i = i0; i < r1; i++)
+				col[i] -= f0*p0[i];
+		}
+	}
+
+	return;
+}
+
+
+/*
+ Blocked right-looking Cholesky factorisation A = L*L**T of the lower
+ triangle of a column-major matrix. Returns 0 or the LAPACK-style info.
+*/
+static long lapack_potrf_lower(double *a, long n, long lda)
+{
+	lapacktilestruct tile;
+	double *colj, *colc, ajj, f;
+	long i, j, c, k0, k1;
+
+	for (k0 = 0; k0 < n; k0 = k1)
+	{
+		k1 = (k0 + LAPACK_NB < n) ? k0 + LAPACK_NB : n;
+		// Factor the panel, including the part below the diagonal block
+		for (j = k0; j < k1; j++)
+		{
+			colj = a + j*lda;
+			ajj = colj[j];
+			if (ajj <= 0.0)
+				return j+1;
+			colj[j] = ajj = sqrt(ajj);
+			ajj = 1.0/ajj;
+			for (i = j+1; i < n; i++)
+				colj[i] *= ajj;
+			for (c = j+1; c < k1; c++)
+			{
+				colc = a + c*lda;
+				f = colj[c];
+				for (i = c; i < n; i++)
+					colc[i] -= f*colj[i];
+			}
+		}
+		// Update the trailing matrix with the panel, tile by tile
+		if (k1 < n)
+		{
+			tile.a = a;
+			tile.lda = lda;
+			tile.n = n;
+			tile.k0 = k0;
+			tile.k1 = k1;
+			tile.nblock = (int)((n - k1 + LAPACK_NB - 1)/LAPACK_NB);
+			lapack_run(lapack_potrf_tile, &tile, (tile.nblock*(tile.nblock+1))/2, n-k1);
+		}
+	}
+
+	return 0;
+}
+
+
+void dposv_internal(char *UPLO, long *N, long *NRHS, double *A, long *LDA, double *B, long *LDB, long *info)
+{
+	// See lapack_stub.cc for the description of the arguments
+	double *b, *col, val;
+	long n = *N, lda = *LDA, i, j, r;
+
+	if (*UPLO != 'L' && *UPLO != 'U')
+	{
+		*info = -1;
+		return;
+	}
+	if (*UPLO == 'U')
+		lapack_swaptri(A, n, lda);
+	*info = lapack_potrf_lower(A, n, lda);
+	// Solve L*L**T*X = B
+	if (!*info)
+		for (r = 0; r < *NRHS; r++)
+		{
+			b = B + r**LDB;
+			for (j = 0; j < n; j++)
+			{
+				col = A + j*lda;
+				val = (b[j] /= col[j]);
+				for (i = j+1; i < n; i++)
+					b[i] -= val*col[i];
+			}
+			for (j = n; j--;)
+			{
+				col = A + j*lda;
+				val = b[j];
+				for (i = j+1; i < n; i++)
+					val -= col[i]*b[i];
+				b[j] = val/col[j];
+			}
+		}
+	if (*UPLO == 'U')
+		lapack_swaptri(A, n, lda);
+
+	return;
+}
+
+
+/*
+ Trailing update of the packed Cholesky factorisation for one group of rows.
+ Column j of the packed lower triangle is row j of R = L**T, which starts at
+ index j*n-j*(j-1)/2 and holds R(j,j..n-1) (see dppsv_internal() in
+ lapack_stub.cc). Rows are interleaved among tasks to balance the work.
+*/
+#define	RROW(j)	(tile->a + (j)*tile->n - ((j)*((j)-1))/2)
+
+static void lapack_pptrf_tile(void *arg, int task)
+{
+	lapacktilestruct *tile = (lapacktilestruct *)arg;
+	double *b, *a0, *a1, *a2, *a3, f0, f1, f2, f3;
+	long n = tile->n, j0 = tile->k0, j1 = tile->k1, j, r, c, nc;
+
+	for (r = j1 + task; r < n; r += tile->nblock)
+	{
+		b = RROW(r);
+		nc = n-r;
+		for (j = j0; j+3 < j1; j += 4)
+		{
+			a0 = RROW(j) + (r-j);
+			a1 = RROW(j+1) + (r-j-1);
+			a2 = RROW(j+2) + (r-j-2);
+			a3 = RROW(j+3) + (r-j-3);
+			f0 = a0[0];
+			f1 = a1[0];
+			f2 = a2[0];
+			f3 = a3[0];
+			for (c = 0; c < nc; c++)
+				b[c] -= f0*a0[c] + f1*a1[c] + f2*a2[c] + f3*a3[c];
+		}
+		for (; j < j1; j++)
+		{
+			a0 = RROW(j) + (r-j);
+			f0 = a0[0];
+			for (c = 0; c < nc; c++)
+				b[c] -= f0*a0[c];
+		}
+	}
+
+	return;
+}
+
+
+void dppsv_internal(char *UPLO, long *N, long *NRHS, double *AP, double *B, long *LDB, long *info)
+{
+	// See lapack_stub.cc for the description of the arguments
+	lapacktilestruct ptile, *tile = &ptile;
+	double *a, *a1, *b, d, s, f0;
+	long n = *N, i, j, j0, j1, c, r;
+
+	*info = 0;
+	if (*UPLO != 'L' && *UPLO != 'U')
+	{
+		*info = -1;
+		return;
+	}
+
+	if (*UPLO == 'L')
+	{
+		tile->a = AP;
+		tile->n = n;
+		for (j0 = 0; j0 < n; j0 = j1)
+		{
+			j1 = (j0 + LAPACK_NB < n) ? j0 + LAPACK_NB : n;
+			// Factor the current panel
+			for (j = j0; j < j1; j++)
+			{
+				a = RROW(j);
+				if (a[0] <= 0.0)
+				{
+					*info = j+1;
+					return;
+				}
+				a[0] = d = sqrt(a[0]);
+				d = 1.0/d;
+				for (c = 1; c < n-j; c++)
+					a[c] *= d;
+				for (r = j+1; r < j1; r++)
+				{
+					a1 = a + (r-j);
+					f0 = a1[0];
+					b = RROW(r);
+					for (c = 0; c < n-r; c++)
+						b[c] -= f0*a1[c];
+				}
+			}
+			// Update the trailing rows with the whole panel
+			if (j1 < n)
+			{
+				tile->k0 = j0;
+				tile->k1 = j1;
+				tile->nblock = (int)((n - j1 + 15)/16);
+				lapack_run(lapack_pptrf_tile, tile, tile->nblock, n-j1);
+			}
+		}
+		// Solve R**T*R*X = B
+		for (i = 0; i < *NRHS; i++)
+		{
+			b = B + i**LDB;
+			for (j = 0; j < n; j++)
+			{
+				a = RROW(j);
+				f0 = (b[j] /= a[0]);
+				for (c = 1; c < n-j; c++)
+					b[j+c] -= f0*a[c];
+			}
+			for (j = n; j--;)
+			{
+				a = RROW(j);
+				s = b[j];
+				for (c = 1; c < n-j; c++)
+					s -= a[c]*b[j+c];
+				b[j] = s/a[0];
+			}
+		}
+	}
+	else
+	{
+		// Row j of L = U**T starts at index j*(j+1)/2 and holds L(j,0..j)
+#define	LROW(j)	(AP + ((j)*((j)+1))/2)
+		for (j = 0; j < n; j++)
+		{
+			a = LROW(j);
+			for (i = 0; i <= j; i++)
+			{
+				a1 = LROW(i);
+				s = a[i];
+				for (c = 0; c < i; c++)
+					s -= a[c]*a1[c];
+				if (i < j)
+					a[i] = s/a1[i];
+				else if (s <= 0.0)
+				{
+					*info = j+1;
+					return;
+				}
+				else
+					a[j] = sqrt(s);
+			}
+		}
+		// Solve L*L**T*X = B
+		for (i = 0; i < *NRHS; i++)
+		{
+			b = B + i**LDB;
+			for (j = 0; j < n; j++)
+			{
+				a = LROW(j);
+				s = b[j];
+				for (c = 0; c < j; c++)
+					s -= a[c]*b[c];
+				b[j] = s/a[j];
+			}
+			for (j = n; j--;)
+			{
+				a = LROW(j);
+				f0 = (b[j] /= a[j]);
+				for (c = 0; c < j; c++)
+					b[c] -= f0*a[c];
+			}
+		}
+#undef	LROW
+	}
+
+	return;
+}
+
+#undef	RROW
+
+
+/*
+ In-place product x = T*x, where T is the lower triangular matrix of order n
+ at a (already inverted, with unit diagonal if unit != 0).
+*/
+static void lapack_trmv_lower(double *a, long n, long lda, int unit, double *x)
+{
+	double *col, val;
+	long i, k;
+
+	for (k = n; k--;)
+	{
+		col = a + k*lda;
+		val = x[k];
+		for (i = k+1; i < n; i++)
+			x[i] += col[i]*val;
+		if (!unit)
+			x[k] = val*col[k];
+	}
+
+	return;
+}
+
+
+/*
+ Inversion of a lower triangular matrix by panels, as in LAPACK dtrtri:
+ for each panel, from the last one,
+   A21 = -inv(A22)*A21*inv(A11)
+ with inv(A22) already computed, then A11 = inv(A11).
+ The first step is parallelised over the panel columns, the second one over
+ groups of rows.
+*/
+typedef struct
+{
+	double	*a;		// Matrix
+	long	lda;		// Leading dimension
+	long	n;		// Order of the matrix
+	long	k0, k1;		// Current panel
+	int	unit;		// Unit diagonal?
+	int	nrowtask;	// Number of row tasks
+} lapacktritilestruct;
+
+static void lapack_trtri_trmm(void *arg, int task)
+{
+	lapacktritilestruct *tile = (lapacktritilestruct *)arg;
+	long k1 = tile->k1;
+
+	// Column k0+task of A21 times inv(A22)
+	lapack_trmv_lower(tile->a + k1 + k1*tile->lda, tile->n - k1, tile->lda,
+		tile->unit, tile->a + k1 + (tile->k0 + task)*tile->lda);
+
+	return;
+}
+
+static void lapack_trtri_trsm(void *arg, int task)
+{
+	lapacktritilestruct *tile = (lapacktritilestruct *)arg;
+	double *a = tile->a, *colc, *colk, f;
+	long lda = tile->lda, k0 = tile->k0, k1 = tile->k1, n = tile->n,
+		r0, r1, i, c, k;
+
+	// Solve X*A11 = -A21 for a group of rows of X, from the last column
+	r0 = k1 + ((n - k1)*task)/tile->nrowtask;
+	r1 = k1 + ((n - k1)*(task+1))/tile->nrowtask;
+	for (c = k1; c-- > k0;)
+	{
+		colc = a + c*lda;
+		for (i = r0; i < r1; i++)
+			colc[i] = -colc[i];
+		for (k = c+1; k < k1; k++)
+		{
+			colk = a + k*lda;
+			f = colc[k];
+			for (i = r0; i < r1; i++)
+				colc[i] -= colk[i]*f;
+		}
+		if (!tile->unit)
+		{
+			f = 1.0/colc[c];
+			for (i = r0; i < r1; i++)
+				colc[i] *= f;
+		}
+	}
+
+	return;
+}
+
+void dtrtri_internal(char *UPLO, char *DIAG, long *N, double *A, long *LDA, long *info)
+{
+	// See lapack_stub.cc for the description of the arguments
+	lapacktritilestruct tile;
+	double *col, ajj;
+	long n = *N, lda = *LDA, i, j, k0, k1, nblock;
+	int unit;
+
+	*info = 0;
+	if (*UPLO != 'L' && *UPLO != 'U')
+	{
+		*info = -1;
+		return;
+	}
+	if (*DIAG != 'N' && *DIAG != 'U')
+	{
+		*info = -2;
+		return;
+	}
+	unit = (*DIAG == 'U');
+	if (!unit)
+		for (j = 0; j < n; j++)
+			if (A[j+j*lda] == 0.0)
+			{
+				*info = j+1;
+				return;
+			}
+
+	if (*UPLO == 'U')
+		lapack_swaptri(A, n, lda);
+	tile.a = A;
+	tile.lda = lda;
+	tile.n = n;
+	tile.unit = unit;
+	nblock = (n + LAPACK_NB - 1)/LAPACK_NB;
+	for (k0 = (nblock-1)*LAPACK_NB; k0 >= 0; k0 -= LAPACK_NB)
+	{
+		k1 = (k0 + LAPACK_NB < n) ? k0 + LAPACK_NB : n;
+		if (k1 < n)
+		{
+			tile.k0 = k0;
+			tile.k1 = k1;
+			lapack_run(lapack_trtri_trmm, &tile, (int)(k1-k0), n-k1);
+			tile.nrowtask = (int)((n - k1 + 15)/16);
+			lapack_run(lapack_trtri_trsm, &tile, tile.nrowtask, n-k1);
+		}
+		// Invert the diagonal block (unblocked)
+		for (j = k1; j-- > k0;)
+		{
+			col = A + j*lda;
+			if (!unit)
+				ajj = -(col[j] = 1.0/col[j]);
+			else
+				ajj = -1.0;
+			lapack_trmv_lower(A + (j+1) + (j+1)*lda, k1-j-1, lda, unit, col+j+1);
+			for (i = j+1; i < k1; i++)
+				col[i] *= ajj;
+		}
+	}
+	if (*UPLO == 'U')
+		lapack_swaptri(A, n, lda);
+
+	return;
+}
@@ -1,12 +1,15 @@
 /*
- This code reproduces two of the functions of lapack with an implementation
+ This code reproduces some of the functions of lapack with an implementation
  using gsl. This allows the use of these functions without the need to link to
- any fortran code. For compatibility, all of the same arguments are taken, but
- some of the arguments may not be used. For instance dposv_internal takes an argument U
- or L but will actually return the full solution, not simply the upper or
- lower part.
+ any fortran code. For compatibility, all of the same arguments are taken.
+ Matrices follow the column-major conventions described in lapack_stub.h:
+ dposv_internal copies the triangle selected by UPLO to the other one before
+ calling gsl, so on exit both triangles of A are overwritten. dtrtri_internal
+ reads and writes only the triangle selected by UPLO (without its diagonal if
+ DIAG = 'U'), like LAPACK.
 */
 #include <stdio.h>
+#include <math.h>
 #include <gsl/gsl_linalg.h>
 #include <gsl/gsl_errno.h>
 #include <gsl/gsl_blas.h>
@@ -70,26 +73,248 @@ void dposv_internal(char *UPLO, long *N, long *NRHS, double *A, long *LDA, doubl
                   puted.
 
          */
-	gsl_matrix_view m = gsl_matrix_view_array(A, *LDA, *N);
-	gsl_vector_view b = gsl_vector_view_array(B, *LDB);
+	long n = *N, lda = *LDA, i, j;
 
-	*info = gsl_linalg_cholesky_decomp(&m.matrix);
-	if (*info != 0)
+	if (*UPLO != 'L' && *UPLO != 'U')
 	{
+		*info = -1;
 		return;
 	}
+	// gsl reads the lower triangle of a row-major matrix, which is the upper
+	// triangle in column-major order: make A symmetric from the triangle
+	// selected by UPLO
+	for (j = 0; j < n; j++)
+		for (i = j+1; i < n; i++)
+			if (*UPLO == 'L')
+				A[j + i*lda] = A[i + j*lda];
+			else
+				A[i + j*lda] = A[j + i*lda];
+
+	gsl_matrix_view m = gsl_matrix_view_array_with_tda(A, n, n, lda);
 
-	*info = gsl_linalg_cholesky_svx(&m.matrix, &b.vector);
+	*info = gsl_linalg_cholesky_decomp(&m.matrix);
 	if (*info != 0)
 	{
 		return;
 	}
 
+	for (i = 0; i < *NRHS; i++)
+	{
+		gsl_vector_view b = gsl_vector_view_array(B + i**LDB, n);
+		*info = gsl_linalg_cholesky_svx(&m.matrix, &b.vector);
+		if (*info != 0)
+		{
+			return;
+		}
+	}
+
 	*info = 0;
 	return;
 }
 
 
+// Number of rows factored at once by dppsv_internal() before the trailing
+// rows are updated
+#define DPPSV_NB	64
+
+void dppsv_internal(char *UPLO, long *N, long *NRHS, double *AP, double *B, long *LDB, long *info)
+{
+        /*
+          Note:
+          Linear algebra function from lapack, implemented directly as gsl
+          has no support for packed matrices. What follows is the argument
+          description from the original function
+
+          DPPSV - compute the solution to a real system of linear equations
+          A * X = B, where A is an N-by-N symmetric positive definite matrix
+          stored in packed format
+
+          ARGUMENTS
+          UPLO    (input) CHARACTER*1
+                  = 'U':  Upper triangle of A is stored;
+                  = 'L':  Lower triangle of A is stored.
+
+          N       (input) INTEGER
+                  The number of linear equations, i.e., the order of
+                  the matrix A.  N >= 0.
+
+          NRHS    (input) INTEGER
+                  The number of right hand sides, i.e., the number of
+                  columns of the matrix B.  NRHS >= 0.
+
+          AP      (input/output) DOUBLE PRECISION array, dimension
+                  (N*(N+1)/2)
+                  On entry, the upper or lower triangle of the symmetric
+                  matrix A, packed columnwise in a linear array.  The j-th
+                  column of A is stored in the array AP as follows:  if
+                  UPLO = 'U', AP(i + (j-1)*j/2) = A(i,j) for 1<=i<=j; if
+                  UPLO = 'L', AP(i + (j-1)*(2n-j)/2) = A(i,j) for j<=i<=n.
+
+                  On exit, if INFO = 0, the factor U or L from the
+                  Cholesky factorization A = U**T*U or A = L*L**T, in the
+                  same storage format as A.
+
+          B       (input/output) DOUBLE PRECISION array, dimension
+                  (LDB,NRHS)
+                  On entry, the N-by-NRHS right hand side matrix B.
+                  On exit, if INFO = 0, the N-by-NRHS solution matrix X.
+
+          LDB     (input) INTEGER
+                  The leading dimension of the array B.  LDB >= max(1,N).
+
+          INFO    (output) INTEGER
+                  = 0:  successful exit
+                  < 0:  if INFO = -i, the i-th argument had an illegal
+                  value
+                  > 0:  if INFO = i, the leading minor of order i of A
+                  is not positive definite, so the factorization could
+                  not be completed, and the solution has not been com-
+                  puted.
+
+         */
+	long n = *N, i, j, j0, j1, c, r, nc;
+	double *a, *a0, *a1, *a2, *a3, *b, d, s, f0, f1, f2, f3;
+
+	*info = 0;
+	if (*UPLO != 'L' && *UPLO != 'U')
+	{
+		*info = -1;
+		return;
+	}
+
+	if (*UPLO == 'L')
+	{
+		// The columns of L are the rows of the upper triangle of a row-major
+		// matrix R = L**T: row j starts at index j*n-j*(j-1)/2 and holds
+		// R(j,j..n-1). The factorisation is right-looking, by panels of
+		// DPPSV_NB rows that are applied to the trailing rows at once.
+#define	RROW(j)	(AP + (j)*n - ((j)*((j)-1))/2)
+		for (j0 = 0; j0 < n; j0 += DPPSV_NB)
+		{
+			j1 = (j0 + DPPSV_NB < n) ? j0 + DPPSV_NB : n;
+			// Factor the current panel
+			for (j = j0; j < j1; j++)
+			{
+				a = RROW(j);
+				if (a[0] <= 0.0)
+				{
+					*info = j+1;
+					return;
+				}
+				a[0] = d = sqrt(a[0]);
+				d = 1.0/d;
+				for (c = 1; c < n-j; c++)
+					a[c] *= d;
+				for (r = j+1; r < j1; r++)
+				{
+					a0 = a + (r-j);
+					f0 = a0[0];
+					b = RROW(r);
+					for (c = 0; c < n-r; c++)
+						b[c] -= f0*a0[c];
+				}
+			}
+			// Update the trailing rows with the whole panel
+			for (r = j1; r < n; r++)
+			{
+				b = RROW(r);
+				nc = n-r;
+				for (j = j0; j+3 < j1; j += 4)
+				{
+					a0 = RROW(j) + (r-j);
+					a1 = RROW(j+1) + (r-j-1);
+					a2 = RROW(j+2) + (r-j-2);
+					a3 = RROW(j+3) + (r-j-3);
+					f0 = a0[0];
+					f1 = a1[0];
+					f2 = a2[0];
+					f3 = a3[0];
+					for (c = 0; c < nc; c++)
+						b[c] -= f0*a0[c] + f1*a1[c] + f2*a2[c] + f3*a3[c];
+				}
+				for (; j < j1; j++)
+				{
+					a0 = RROW(j) + (r-j);
+					f0 = a0[0];
+					for (c = 0; c < nc; c++)
+						b[c] -= f0*a0[c];
+				}
+			}
+		}
+		// Solve R**T*R*X = B
+		for (i = 0; i < *NRHS; i++)
+		{
+			b = B + i**LDB;
+			for (j = 0; j < n; j++)
+			{
+				a = RROW(j);
+				f0 = (b[j] /= a[0]);
+				for (c = 1; c < n-j; c++)
+					b[j+c] -= f0*a[c];
+			}
+			for (j = n; j--;)
+			{
+				a = RROW(j);
+				s = b[j];
+				for (c = 1; c < n-j; c++)
+					s -= a[c]*b[j+c];
+				b[j] = s/a[0];
+			}
+		}
+#undef	RROW
+	}
+	else
+	{
+		// The columns of U are the rows of the lower triangle of a row-major
+		// matrix L = U**T: row j starts at index j*(j+1)/2 and holds L(j,0..j).
+		// Each element is obtained with a dot product of two row prefixes.
+#define	LROW(j)	(AP + ((j)*((j)+1))/2)
+		for (j = 0; j < n; j++)
+		{
+			a = LROW(j);
+			for (i = 0; i <= j; i++)
+			{
+				a1 = LROW(i);
+				s = a[i];
+				for (c = 0; c < i; c++)
+					s -= a[c]*a1[c];
+				if (i < j)
+					a[i] = s/a1[i];
+				else if (s <= 0.0)
+				{
+					*info = j+1;
+					return;
+				}
+				else
+					a[j] = sqrt(s);
+			}
+		}
+		// Solve L*L**T*X = B
+		for (i = 0; i < *NRHS; i++)
+		{
+			b = B + i**LDB;
+			for (j = 0; j < n; j++)
+			{
+				a = LROW(j);
+				s = b[j];
+				for (c = 0; c < j; c++)
+					s -= a[c]*b[c];
+				b[j] = s/a[j];
+			}
+			for (j = n; j--;)
+			{
+				a = LROW(j);
+				f0 = (b[j] /= a[j]);
+				for (c = 0; c < j; c++)
+					b[c] -= f0*a[c];
+			}
+		}
+#undef	LROW
+	}
+
+	return;
+}
+
 void dtrtri_internal(char *UPLO, char *DIAG, long *N, double *A, long *LDA, long *info)
 {
         /*
@@ -142,53 +367,61 @@ void dtrtri_internal(char *UPLO, char *DIAG, long *N, double *A, long *LDA, long
                 be computed.
 
           */
-	CBLAS_TRANSPOSE_t transa;
-	long start, end, i, j;
-	gsl_matrix_view m = gsl_matrix_view_array(A, *LDA, *N);
-	gsl_vector *temp = gsl_vector_calloc(*LDA**LDA);
-	gsl_vector_view view;
-
-	// Check if the upper or lower triangle is to be inverted: these blocks
-	// define some conditions that will always be true in these circumstances,
-	// such as the start or ending position of copying the inverted row into
-	// origional matrix. We also set if the matrix should be inverted for the
-	// solution or not.
-	if (*UPLO == 'L')
+	long n = *N, lda = *LDA, i, j;
+	CBLAS_UPLO_t uplo;
+	CBLAS_DIAG_t diag;
+	gsl_matrix *inv;
+
+	*info = 0;
+	if (*UPLO != 'L' && *UPLO != 'U')
 	{
-		start = end = 0;
-		transa = CblasNoTrans;
+		*info = -1;
+		return;
 	}
-	else
+	if (*DIAG != 'N' && *DIAG != 'U')
 	{
-		start = 1;
-		end = *LDA;
-		transa = CblasTrans;
+		*info = -2;
+		return;
 	}
+	if (n == 0)
+		return;
+	if (*DIAG == 'N')
+		for (i = 0; i < n; i++)
+			if (A[i + i*lda] == 0.0)
+			{
+				*info = i+1;
+				return;
+			}
 
-	for (i = 0; i < *LDA; i++)
+	// The row-major gsl view of A is its transpose T: the triangle of A
+	// selected by UPLO is the opposite triangle of T, and the inverse of T is
+	// the transpose of the inverse of A. Column i of inv(T) is obtained by
+	// solving T*x = e_i, and is stored in row i of inv.
+	gsl_matrix_view m = gsl_matrix_view_array_with_tda(A, n, n, lda);
+	uplo = (*UPLO == 'L') ? CblasUpper : CblasLower;
+	diag = (*DIAG == 'U') ? CblasUnit : CblasNonUnit;
+	inv = gsl_matrix_calloc(n, n);
+	for (i = 0; i < n; i++)
 	{
-		temp->data[i**LDA+i] = 1;
-		view = gsl_vector_subvector(temp, i**LDA, *LDA);
-		*info = gsl_blas_dtrsv(CblasLower, transa, CblasNonUnit, &m.matrix, &view.vector);
+		gsl_vector_view x = gsl_matrix_row(inv, i);
+		gsl_vector_set(&x.vector, i, 1.0);
+		gsl_blas_dtrsv(uplo, CblasNoTrans, diag, &m.matrix, &x.vector);
+	}
+
+	// inv(T)(j,i) goes to A(i,j) = T(j,i): only the triangle selected by UPLO
+	// is written, and the diagonal is left alone if it is unit
+	for (i = 0; i < n; i++)
 		if (*UPLO == 'L')
 		{
-			end = i;
+			for (j = 0; j < ((*DIAG == 'U') ? i : i+1); j++)
+				A[i + j*lda] = inv->data[i*inv->tda + j];
 		}
 		else
 		{
-			start = i+1;
-		}
-
-		for (j = start; j < end; j++)
-		{
-			temp->data[i**LDA+j] = A[i**LDA+j];
+			for (j = (*DIAG == 'U') ? i+1 : i; j < n; j++)
+				A[i + j*lda] = inv->data[i*inv->tda + j];
 		}
-	}
-	for (i = 0; i < *LDA**LDA; i++)
-	{
-		A[i] = temp->data[i];
-	}
 
-	gsl_vector_free(temp);
+	gsl_matrix_free(inv);
 	return;
 }
@@ -1,8 +1,18 @@
 /*
  Header file to supply the definitions of reimplemented lapack functionality
 
- These two functions are used in PSFEx solver, but have been reimplemented to
- avoid a dependancy on anything fortran. the source can be found in src/clapack.c
+ These functions are used in PSFEx solver, but have been reimplemented to
+ avoid a dependancy on anything fortran. the source can be found in
+ src/lapack_stub.cc
+
+ All the implementations (lapack_stub.cc, lapack_system.c and lapack_blocked.c,
+ selected with PSFEX_LAPACK_BACKEND) follow the LAPACK conventions: matrices
+ are stored in column-major order, element (i,j) of A being A[i + j*LDA], and
+ only the triangle selected by UPLO is read. In particular UPLO = "L" reads
+ A[i + j*LDA] for i >= j, that is the upper triangle of a matrix filled in
+ row-major (C) order. Packed matrices hold the same triangle, packed
+ columnwise. Callers must either fill the triangle they pass as UPLO, or the
+ whole symmetric matrix.
 */
 
 #ifdef __cplusplus
@@ -10,6 +20,8 @@ extern "C" {
 #endif
 void dposv_internal(char *, long *, long *, double *, long *, double *, long *, long *);
 
+void dppsv_internal(char *, long *, long *, double *, double *, long *, long *);
+
 void dtrtri_internal(char *, char *, long *, double *, long *, long *);
 #ifdef __cplusplus
 }
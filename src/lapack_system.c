@@ -0,0 +1,44 @@
+/*
+ This code provides the functions declared in lapack_stub.h by calling the
+ LAPACK library found on the system (reference LAPACK, OpenBLAS, MKL...). It
+ is selected with -DPSFEX_LAPACK_BACKEND=LAPACK at configure time. All
+ arguments are honoured, with the usual column-major LAPACK conventions (see
+ lapack_stub.h).
+*/
+#include "lapack_stub.h"
+
+extern void dposv_(char *, int *, int *, double *, int *, double *, int *, int *);
+extern void dppsv_(char *, int *, int *, double *, double *, int *, int *);
+extern void dtrtri_(char *, char *, int *, double *, int *, int *);
+
+void dposv_internal(char *UPLO, long *N, long *NRHS, double *A, long *LDA, double *B, long *LDB, long *info)
+{
+	// See lapack_stub.cc for the description of the arguments
+	int n = (int)*N, nrhs = (int)*NRHS, lda = (int)*LDA, ldb = (int)*LDB, inf = 0;
+
+	dposv_(UPLO, &n, &nrhs, A, &lda, B, &ldb, &inf);
+	*info = inf;
+	return;
+}
+
+
+void dppsv_internal(char *UPLO, long *N, long *NRHS, double *AP, double *B, long *LDB, long *info)
+{
+	// See lapack_stub.cc for the description of the arguments
+	int n = (int)*N, nrhs = (int)*NRHS, ldb = (int)*LDB, inf = 0;
+
+	dppsv_(UPLO, &n, &nrhs, AP, B, &ldb, &inf);
+	*info = inf;
+	return;
+}
+
+
+void dtrtri_internal(char *UPLO, char *DIAG, long *N, double *A, long *LDA, long *info)
+{
+	// See lapack_stub.cc for the description of the arguments
+	int n = (int)*N, lda = (int)*LDA, inf = 0;
+
+	dtrtri_(UPLO, DIAG, &n, A, &lda, &inf);
+	*info = inf;
+	return;
+}
@@ -54,6 +54,16 @@
 psfstruct	*make_psf(setstruct *set, float psfstep,
 			float *basis, int nbasis, contextstruct *context);
 
+static setstruct	*load_set(samplecachestruct **cache, char **incatnames,
+				int catindex, int ncat, int ext, int next,
+				contextstruct *context),
+			*load_master(samplecachestruct **cache,
+				char **incatnames, int catindex, int ncat,
+				int next, contextstruct *context, int free_sets),
+			*load_view(setstruct *master, samplecachestruct **cache,
+				char **incatnames, int catindex, int ncat,
+				int ext, int next, contextstruct *context);
+
 /********************************** makeit_body ******************************/
 /*
 */
@@ -69,8 +79,9 @@ makeit_body(
    fieldstruct		*field;
    psfstruct		**cpsf,
 			*psf;
-   setstruct		*set, *set2;
+   setstruct		*set, *set2, *master;
    contextstruct	*context, *fullcontext;
+   samplecachestruct	*cache, **pcache;
    char			str[MAXCHAR];
    char			**incatnames;
    float		**psfbasiss,
@@ -88,6 +99,15 @@ makeit_body(
   psfbasis = NULL;
   psfbasiss = NULL;
 
+/* Samples are kept between passes only if we own them */
+  cache = NULL;
+  pcache = (free_sets && prefs.samplecache_flag)? &cache : NULL;
+
+/* Samples filled by the caller come with full-precision weight-maps only */
+  if (!free_sets && prefs.sample_precision == SAMPLE_PRECISION_HALF)
+    error(EXIT_FAILURE, "*Error*: SAMPLE_PRECISION HALF requires ",
+	"samples loaded by PSFEx itself");
+
 /* Initialize context */
   NFPRINTF(OUTPUT, "Initializing contexts...");
   context = context_init(prefs.context_name, prefs.context_group,
@@ -116,7 +136,8 @@ makeit_body(
 	|| (prefs.stability_type == STABILITY_SEQUENCE
 		&& prefs.psf_mef_type == PSF_MEF_COMMON))
       {
-      set = load_samples(incatnames, 0, ncat, ALL_EXTENSIONS, next, context);
+      set = load_set(pcache, incatnames, 0, ncat, ALL_EXTENSIONS, next,
+		context);
       psfstep = (float)((set->fwhm/2.35)*0.5);
       if (free_sets) end_set(set);
       }
@@ -128,12 +149,17 @@ makeit_body(
       {
 /*-- Run through all samples to derive a different pixel step for each extension */
       QMALLOC(psfsteps, float, next);
+      master = load_master(pcache, incatnames, 0, ncat, next, context,
+		free_sets);
       for (ext=0 ; ext<next; ext++)
         {
-        set = load_samples(incatnames, 0, ncat, ext, next, context);
+        set = load_view(master, pcache, incatnames, 0, ncat, ext, next,
+		context);
         psfsteps[ext] = (float)(psfstep? psfstep : (set->fwhm/2.35)*0.5);
         if (free_sets) end_set(set);
         }
+      if (master)
+        end_set(master);
       }
     }
 
@@ -147,7 +173,7 @@ makeit_body(
         sprintf(str, "Computing new PCA image basis from %s...",
 		fields[c]->rtcatname);
         NFPRINTF(OUTPUT, str);
-        set = load_samples(incatnames, c, 1, ext, next, context);
+        set = load_set(pcache, incatnames, c, 1, ext, next, context);
         step = psfstep;
         cpsf[c+ext*ncat] = make_psf(set, psfstep, NULL, 0, context);
         if (free_sets) end_set(set);
@@ -163,6 +189,8 @@ makeit_body(
     {
     nbasis = prefs.newbasis_number;
     QMALLOC(psfbasiss, float *, next);
+    master = load_master(pcache, incatnames, 0, ncat, next, context,
+		free_sets);
     for (ext=0; ext<next; ext++)
       {
       if (psfsteps)
@@ -175,7 +203,7 @@ makeit_body(
         sprintf(str, "Computing new PCA image basis from %s...",
 		fields[c]->rtcatname);
         NFPRINTF(OUTPUT, str);
-        set = load_samples(incatnames, c, 1, ext, next, context);
+        set = load_view(master, pcache, incatnames, c, 1, ext, next, context);
         cpsf[c] = make_psf(set, step, NULL, 0, context);
         if (free_sets) end_set(set);
         }
@@ -184,6 +212,8 @@ makeit_body(
         psf_end(cpsf[c]);
       free(cpsf);
       }
+    if (master)
+      end_set(master);
     }
 
   if (context->npc && prefs.hidden_mef_type == HIDDEN_MEF_COMMON)
@@ -196,9 +226,10 @@ makeit_body(
       sprintf(str, "Computing hidden dependency parameter(s) from %s...",
 		fields[c]->rtcatname);
       NFPRINTF(OUTPUT, str);
+      master = load_master(pcache, incatnames, c, 1, next, context, free_sets);
       for (ext=0 ; ext<next; ext++)
         {
-        set = load_samples(incatnames, c, 1, ext, next, context);
+        set = load_view(master, pcache, incatnames, c, 1, ext, next, context);
         if (psfsteps)
           step = psfsteps[ext];
         else
@@ -207,6 +238,8 @@ makeit_body(
         cpsf[p++] = make_psf(set, step, basis, nbasis, context);
         if (free_sets) end_set(set);
         }
+      if (master)
+        end_set(master);
       }
     free(fullcontext->pc);
     fullcontext->pc = pca_oncomps(cpsf, next, ncat, context->npc);
@@ -221,7 +254,8 @@ makeit_body(
     if (prefs.stability_type == STABILITY_SEQUENCE)
       {
 /*---- Load all the samples at once */
-      set = load_samples(incatnames, 0, ncat, ALL_EXTENSIONS, next, context);
+      set = load_set(pcache, incatnames, 0, ncat, ALL_EXTENSIONS, next,
+		context);
       step = psfstep;
       basis = psfbasis;
       field_count(fields, set, COUNT_LOADED);
@@ -239,7 +273,8 @@ makeit_body(
         sprintf(str, "Computing final PSF model from %s...",
 		fields[c]->rtcatname);
         NFPRINTF(OUTPUT, str);
-        set = load_samples(incatnames, c, 1, ALL_EXTENSIONS, next, context);
+        set = load_set(pcache, incatnames, c, 1, ALL_EXTENSIONS, next,
+		context);
         if (psfstep)
           step = psfstep;
         else
@@ -254,6 +289,14 @@ makeit_body(
         }
     }
   else
+    {
+    master = (prefs.stability_type == STABILITY_EXPOSURE
+		|| fullcontext == context
+		|| (context->npc
+			&& prefs.hidden_mef_type == HIDDEN_MEF_INDEPENDENT))?
+		load_master(pcache, incatnames, 0, ncat, next, context,
+			free_sets)
+		: NULL;
     for (ext=0 ; ext<next; ext++)
       {
       basis = psfbasiss? psfbasiss[ext] : psfbasis;
@@ -275,7 +318,8 @@ makeit_body(
             sprintf(str, "Computing hidden dependency parameter(s) from %s...",
 		fields[c]->rtcatname);
           NFPRINTF(OUTPUT, str);
-          set = load_samples(incatnames, c, 1, ext, next, context);
+          set = load_view(master, pcache, incatnames, c, 1, ext, next,
+		context);
           field_count(fields, set, COUNT_LOADED);
           cpsf[c] = make_psf(set, step, basis, nbasis, context);
           field_count(fields, set, COUNT_ACCEPTED);
@@ -299,7 +343,11 @@ makeit_body(
           }
         else
           NFPRINTF(OUTPUT, "Computing final PSF model...");
-        set = load_samples(incatnames, 0, ncat, ext, next, fullcontext);
+/*------ Hidden dependencies must be read with the new principal components */
+        set = fullcontext==context?
+		load_view(master, pcache, incatnames, 0, ncat, ext, next,
+			context)
+		: load_samples(incatnames, 0, ncat, ext, next, fullcontext);
         if (psfstep)
           step = psfstep;
         else if (psfsteps)
@@ -324,7 +372,8 @@ makeit_body(
             sprintf(str, "Reading data from %s...",
 		fields[c]->rtcatname);
           NFPRINTF(OUTPUT, str);
-          set = load_samples(incatnames, c, 1, ext, next, context);
+          set = load_view(master, pcache, incatnames, c, 1, ext, next,
+		context);
           if (psfstep)
             step = psfstep;
           else if (psfsteps)
@@ -346,6 +395,9 @@ makeit_body(
           psf_end(psf);
           }
       }
+    if (master)
+      end_set(master);
+    }
 
   free(psfsteps);
   if (psfbasiss)
@@ -357,6 +409,9 @@ makeit_body(
   else if (psfbasis)
     free(psfbasis);
 
+/* Free the samples kept between passes */
+  end_samplecache(cache);
+
 /* Do not compute these */
 /* Compute diagnostics and check-images */
 #if 0
@@ -531,6 +586,9 @@ psfstruct	*make_psf(setstruct *set, float psfstep,
   psf_clean(psf, set, prefs.prof_accuracy);
   psf_refine(psf, set);
 
+/* The normal equations are not needed anymore */
+  psf_refine_end(psf);
+
   
 /*-- Just check the Chi2 */
   psf->chi2 = set->nsample? psf_chi2(psf, set) : 0.0;
@@ -538,3 +596,98 @@ psfstruct	*make_psf(setstruct *set, float psfstep,
   
   return psf;
   }
+
+
+/****** load_set *************************************************************
+PROTO	setstruct *load_set(samplecachestruct **cache, char **incatnames,
+			int catindex, int ncat, int ext, int next,
+			contextstruct *context)
+PURPOSE	Load the samples of a range of catalogs, through the sample cache if
+	there is one.
+INPUT	Pointer to the sample cache (or NULL),
+	array of catalog filenames,
+	catalog index,
+	number of catalogs,
+	current extension (or ALL_EXTENSIONS),
+	number of extensions,
+	pointer to the context.
+OUTPUT  Pointer to the set.
+NOTES   With a cache, the set is a view of the cached samples, and catalogs
+	are read again only if other selections of them were loaded in the
+	meantime (see load_cachedsamples()).
+AUTHOR  LSST DM (Rubin Observatory)
+VERSION 18/10/2026
+ ***/
+static setstruct	*load_set(samplecachestruct **cache, char **incatnames,
+				int catindex, int ncat, int ext, int next,
+				contextstruct *context)
+  {
+  if (cache)
+    return load_cachedsamples(cache, incatnames, catindex, ncat, ext, next,
+		context);
+
+  return load_samples(incatnames, catindex, ncat, ext, next, context);
+  }
+
+
+/****** load_master **********************************************************
+PROTO	setstruct *load_master(samplecachestruct **cache, char **incatnames,
+			int catindex, int ncat, int next, contextstruct *context,
+			int free_sets)
+PURPOSE	Load the samples of all extensions at once, if per-extension sets can
+	be derived from them.
+INPUT	Pointer to the sample cache (or NULL),
+	array of catalog filenames,
+	catalog index,
+	number of catalogs,
+	number of extensions,
+	pointer to the context,
+	flag set if makeit_body() owns (and frees) the sets.
+OUTPUT  Pointer to the set of all samples, or NULL if per-extension sets must
+	be loaded separately.
+NOTES   Sample selection does not depend on the extension unless the FWHM
+	range is selected automatically (SAMPLE_AUTOSELECT Y). Sets provided by
+	the caller (free_sets = 0) are always loaded through load_samples().
+AUTHOR  LSST DM (Rubin Observatory)
+VERSION 18/10/2026
+ ***/
+static setstruct	*load_master(samplecachestruct **cache,
+				char **incatnames, int catindex, int ncat,
+				int next, contextstruct *context, int free_sets)
+  {
+  if (!free_sets || prefs.autoselect_flag || next<2)
+    return NULL;
+
+  return load_set(cache, incatnames, catindex, ncat, ALL_EXTENSIONS, next,
+		context);
+  }
+
+
+/****** load_view ************************************************************
+PROTO	setstruct *load_view(setstruct *master, samplecachestruct **cache,
+			char **incatnames, int catindex, int ncat, int ext,
+			int next, contextstruct *context)
+PURPOSE	Get the samples of a range of catalogs for a given extension.
+INPUT	Pointer to the set returned by load_master() (or NULL),
+	pointer to the sample cache (or NULL),
+	array of catalog filenames,
+	catalog index,
+	number of catalogs,
+	current extension,
+	number of extensions,
+	pointer to the context.
+OUTPUT  Pointer to the set.
+NOTES   If master is not NULL, the set is a view of its samples (see
+	view_set()), hence no vignette is read or copied.
+AUTHOR  LSST DM (Rubin Observatory)
+VERSION 18/10/2026
+ ***/
+static setstruct	*load_view(setstruct *master, samplecachestruct **cache,
+				char **incatnames, int catindex, int ncat,
+				int ext, int next, contextstruct *context)
+  {
+  if (master)
+    return view_set(master, catindex, ncat, ext, context);
+
+  return load_set(cache, incatnames, catindex, ncat, ext, next, context);
+  }
@@ -30,13 +30,31 @@
 #include        "config.h"
 #endif
 
+#include	<math.h>
 #include	<stdlib.h>
+#include	<string.h>
 
 #include	"define.h"
 #include	"types.h"
 #include	"globals.h"
 #include	"misc.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define	MISC_F16C
+#include	<immintrin.h>
+#endif
+
+static unsigned short	misc_floattohalf(float val);
+
+static float		misc_halftofloat(unsigned short val);
+
+#ifdef MISC_F16C
+static void		misc_halfenc_f16c(const float *in, unsigned short *out,
+				int n, float scale),
+			misc_halfdec_f16c(const unsigned short *in, float *out,
+				int n, float fac);
+#endif
+
 
 /******* fast_median **********************************************************
 PROTO	float fast_median(float *arr, int n)
@@ -218,3 +236,245 @@ float	fqmedian(float *ra, int n)
   }
 
 
+
+
+/****** half_encode ***********************************************************
+PROTO	float half_encode(const float *in, unsigned short *out, int n)
+PURPOSE	Store an array of floats as scaled IEEE 754 half-precision numbers.
+INPUT	Pointer to the input array,
+	pointer to the output (half-precision) array,
+	number of elements.
+OUTPUT	Factor to apply to decoded values (see half_decode()).
+NOTES	Values are scaled by a power of 2 that brings the largest absolute
+	value to [0.5,1[, hence the scaling is exact and the relative precision
+	is 2^-11 down to 2^-15 of the largest value. Non-zero values that would
+	underflow are stored as the smallest subnormal of the same sign, so
+	that the sign of weights and residuals is preserved.
+	Uses the F16C instructions if the CPU supports them.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+float	half_encode(const float *in, unsigned short *out, int n)
+
+  {
+   float	amax, scale, fac;
+   int		i, e;
+
+  amax = 0.0;
+  for (i=0; i<n; i++)
+    if (fabsf(in[i])>amax)
+      amax = fabsf(in[i]);
+  if (amax>0.0 && amax<BIG)
+    {
+    frexpf(amax, &e);
+    scale = ldexpf(1.0, -e);
+    fac = ldexpf(1.0, e);
+    }
+  else
+    scale = fac = 1.0;
+
+#ifdef MISC_F16C
+  if (__builtin_cpu_supports("f16c"))
+    misc_halfenc_f16c(in, out, n, scale);
+  else
+#endif
+    for (i=0; i<n; i++)
+      out[i] = misc_floattohalf(in[i]*scale);
+
+/* Keep non-zero values non-zero */
+  for (i=0; i<n; i++)
+    if (!(out[i]&0x7fff) && in[i]!=0.0)
+      out[i] = in[i]>0.0? 0x0001 : 0x8001;
+
+  return fac;
+  }
+
+
+/****** half_decode ***********************************************************
+PROTO	void half_decode(const unsigned short *in, float *out, int n, float fac)
+PURPOSE	Convert an array of scaled IEEE 754 half-precision numbers to floats.
+INPUT	Pointer to the input (half-precision) array,
+	pointer to the output array,
+	number of elements,
+	factor returned by half_encode().
+OUTPUT	-.
+NOTES	Uses the F16C instructions if the CPU supports them.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+void	half_decode(const unsigned short *in, float *out, int n, float fac)
+
+  {
+   int		i;
+
+#ifdef MISC_F16C
+  if (__builtin_cpu_supports("f16c"))
+    {
+    misc_halfdec_f16c(in, out, n, fac);
+    return;
+    }
+#endif
+  for (i=0; i<n; i++)
+    out[i] = misc_halftofloat(in[i])*fac;
+
+  return;
+  }
+
+
+/****** misc_floattohalf ******************************************************
+PROTO	unsigned short misc_floattohalf(float val)
+PURPOSE	Convert a float to IEEE 754 half-precision.
+INPUT	Input value.
+OUTPUT	Half-precision bit pattern.
+NOTES	Rounds to nearest even, like the F16C instructions.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+static unsigned short	misc_floattohalf(float val)
+
+  {
+   unsigned int	u, sign, m, h, rem, half;
+   int		shift;
+
+  memcpy(&u, &val, sizeof(u));
+  sign = (u>>16) & 0x8000;
+  u &= 0x7fffffff;
+/* NaN and infinities */
+  if (u>=0x7f800000)
+    return sign | 0x7c00 | (u>0x7f800000? 0x0200 : 0);
+/* Overflow */
+  if (u>=0x477ff000)
+    return sign | 0x7c00;
+/* Subnormals and underflow */
+  if (u<0x38800000)
+    {
+    if (u<0x33000000)
+      return sign;
+    m = (u&0x007fffff) | 0x00800000;
+    shift = 126 - (int)(u>>23);
+    h = m>>shift;
+    rem = m & ((1U<<shift)-1);
+    half = 1U<<(shift-1);
+    if (rem>half || (rem==half && (h&1)))
+      h++;
+    return sign | h;
+    }
+/* Normal numbers */
+  h = (u - 0x38000000)>>13;
+  rem = u & 0x1fff;
+  if (rem>0x1000 || (rem==0x1000 && (h&1)))
+    h++;
+
+  return sign | h;
+  }
+
+
+/****** misc_halftofloat ******************************************************
+PROTO	float misc_halftofloat(unsigned short val)
+PURPOSE	Convert an IEEE 754 half-precision number to a float.
+INPUT	Half-precision bit pattern.
+OUTPUT	Float value.
+NOTES	-.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+static float	misc_halftofloat(unsigned short val)
+
+  {
+   float	fval;
+   unsigned int	u, e, m;
+
+  u = (unsigned int)(val&0x8000)<<16;
+  e = (val>>10) & 0x1f;
+  m = val & 0x3ff;
+  if (!e)
+    {
+    if (m)
+      {
+/*---- Subnormal: normalize */
+      e = 113;
+      while (!(m&0x400))
+        {
+        m <<= 1;
+        e--;
+        }
+      u |= (e<<23) | ((m&0x3ff)<<13);
+      }
+    }
+  else if (e==31)
+    u |= 0x7f800000 | (m<<13);
+  else
+    u |= ((e+112)<<23) | (m<<13);
+  memcpy(&fval, &u, sizeof(fval));
+
+  return fval;
+  }
+
+
+#ifdef MISC_F16C
+/****** misc_halfenc_f16c *****************************************************
+PROTO	void misc_halfenc_f16c(const float *in, unsigned short *out, int n,
+		float scale)
+PURPOSE	Scale and convert floats to half-precision with the F16C instructions.
+INPUT	Pointer to the input array,
+	pointer to the output (half-precision) array,
+	number of elements,
+	scaling factor.
+OUTPUT	-.
+NOTES	-.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+__attribute__((target("avx,f16c")))
+static void	misc_halfenc_f16c(const float *in, unsigned short *out,
+			int n, float scale)
+
+  {
+   __m256	vscale;
+   int		i;
+
+  vscale = _mm256_set1_ps(scale);
+  for (i=0; i+8<=n; i+=8)
+    _mm_storeu_si128((__m128i *)(out+i),
+	_mm256_cvtps_ph(_mm256_mul_ps(_mm256_loadu_ps(in+i), vscale),
+		_MM_FROUND_TO_NEAREST_INT));
+  for (; i<n; i++)
+    out[i] = misc_floattohalf(in[i]*scale);
+
+  return;
+  }
+
+
+/****** misc_halfdec_f16c *****************************************************
+PROTO	void misc_halfdec_f16c(const unsigned short *in, float *out, int n,
+		float fac)
+PURPOSE	Convert half-precision numbers to scaled floats with the F16C
+	instructions.
+INPUT	Pointer to the input (half-precision) array,
+	pointer to the output array,
+	number of elements,
+	scaling factor.
+OUTPUT	-.
+NOTES	-.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+__attribute__((target("avx,f16c")))
+static void	misc_halfdec_f16c(const unsigned short *in, float *out,
+			int n, float fac)
+
+  {
+   __m256	vfac;
+   int		i;
+
+  vfac = _mm256_set1_ps(fac);
+  for (i=0; i+8<=n; i+=8)
+    _mm256_storeu_ps(out+i, _mm256_mul_ps(
+	_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(in+i))), vfac));
+  for (; i<n; i++)
+    out[i] = misc_halftofloat(in[i])*fac;
+
+  return;
+  }
+#endif
+
@@ -31,5 +31,9 @@
 extern double	dqmedian(double *ra, int n);
 
 extern float	fast_median(float *arr, int n),
-		fqmedian(float *ra, int n);
+		fqmedian(float *ra, int n),
+		half_encode(const float *in, unsigned short *out, int n);
+
+extern void	half_decode(const unsigned short *in, float *out, int n,
+			float fac);
 
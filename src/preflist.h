@@ -60,6 +60,9 @@ pkeystruct key[] =
   {"BASIS_NAME", P_STRING, prefs.basis_name},
   {"BASIS_NUMBER", P_INT, &prefs.basis_number, 0,10000},
   {"BASIS_SCALE", P_FLOAT, &prefs.basis_scale, 0,0, 0.0,1.0e3},
+  {"BASIS_SHIFTINTERP", P_KEY, &prefs.basis_shiftinterp, 0,0, 0.0,0.0,
+	{"NEAREST", "BILINEAR", ""}},
+  {"BASIS_SHIFTSTEP", P_FLOAT, &prefs.basis_shiftstep, 0,0, 0.0,1.0},
   {"BASIS_TYPE", P_KEY, &prefs.basis_type, 0,0, 0.0,0.0,
    {"NONE", "PIXEL", "GAUSS-LAGUERRE", "FILE", "PIXEL_AUTO", ""}},
   {"CENTER_KEYS", P_STRINGLIST, prefs.center_key, 0,0,0.0,0.0,
@@ -120,14 +123,19 @@ pkeystruct key[] =
   {"PSF_SAMPLING", P_FLOAT, &prefs.psf_step, 0,0, 0.0,1.0e3},
   {"PSF_SIZE", P_INTLIST, prefs.psf_size, 1,1024, 0.0,0.0, {""},
      1,2, &prefs.npsf_size},
+  {"PSF_SOLVER", P_KEY, &prefs.refine_solver, 0,0, 0.0,0.0,
+	{"AUTO", "DENSE", "SPARSE", "CG", ""}},
   {"PSF_SUFFIX", P_STRING, prefs.psf_suffix},
   {"SAMPLE_AUTOSELECT", P_BOOL, &prefs.autoselect_flag},
+  {"SAMPLE_CACHE", P_BOOL, &prefs.samplecache_flag},
   {"SAMPLE_FLAGMASK", P_INT, &prefs.flag_mask, 0,0xffff},
   {"SAMPLE_FWHMRANGE", P_FLOATLIST, prefs.fwhmrange, 0,0, 0.0,1e3, {""},
      2,2, &prefs.nfwhmrange},
   {"SAMPLE_IMAFLAGMASK", P_INT, &prefs.imaflag_mask, 0,0xff, 0.0,0.0},
   {"SAMPLE_MAXELLIP", P_FLOAT, &prefs.maxellip, 0,0, 0.0, 1.0},
   {"SAMPLE_MINSN", P_FLOAT, &prefs.minsn, 0,0, 1e-6,1e15},
+  {"SAMPLE_PRECISION", P_KEY, &prefs.sample_precision, 0,0, 0.0,0.0,
+	{"FULL", "HALF", ""}},
 //  {"SAMPLE_NMAX", P_INT, &prefs.nmax, 0,2147483648},
   {"SAMPLE_VARIABILITY", P_FLOAT, &prefs.maxvar, 0,0, 0.0, BIG},
   {"SAMPLE_WFLAGMASK", P_INT, &prefs.wflag_mask, 0,0xff, 0.0,0.0},
@@ -158,6 +166,10 @@ char *default_prefs[] =
 "BASIS_NUMBER    20              # Basis number or parameter",
 "*BASIS_NAME      basis.fits      # Basis filename (FITS data-cube)",
 "*BASIS_SCALE     1.0             # Gauss-Laguerre beta parameter",
+"*BASIS_SHIFTSTEP 0.0             # Sub-pixel shift lattice step for non-pixel",
+"*                                # bases (0.0 = exact resampling)",
+"*BASIS_SHIFTINTERP BILINEAR      # Shift lattice interpolation: NEAREST or",
+"*                                # BILINEAR",
 "*NEWBASIS_TYPE   NONE            # Create new basis: NONE, PCA_INDEPENDENT",
 "*                                # or PCA_COMMON",
 "*NEWBASIS_NUMBER 8               # Number of new basis vectors",
@@ -166,6 +178,8 @@ char *default_prefs[] =
 "PSF_ACCURACY    0.01            # Accuracy to expect from PSF \"pixel\" values",
 "PSF_SIZE        25,25           # Image size of the PSF model",
 "*PSF_RECENTER    N               # Allow recentering of PSF-candidates Y/N ?",
+"*PSF_SOLVER      AUTO            # Refinement solver: AUTO, DENSE, SPARSE",
+"*                                # or CG (iterative, low memory)",
 "*MEF_TYPE        INDEPENDENT     # INDEPENDENT or COMMON",
 " ",
 "#------------------------- Point source measurements -------------------------",
@@ -195,6 +209,9 @@ char *default_prefs[] =
 "*SAMPLE_WFLAGMASK   0x0000       # Rejection mask on SExtractor FLAGS_WEIGHT",
 "*SAMPLE_IMAFLAGMASK 0x0          # Rejection mask on SExtractor IMAFLAGS_ISO",
 //"*SAMPLE_NMAX        0            # Maximum number of samples per extension",
+"*SAMPLE_PRECISION   FULL         # Weight and residual map storage: FULL",
+"*                                # (32-bit) or HALF (16-bit)",
+"*SAMPLE_CACHE       Y            # Keep samples in memory between passes (Y/N) ?",
 "*BADPIXEL_FILTER    N            # Filter bad-pixels in samples (Y/N) ?",
 "*BADPIXEL_NMAX      0            # Maximum number of bad pixels allowed",
 " ",
@@ -78,6 +78,9 @@ typedef struct
   int		wflag_mask;			/* Rej. mask on FLAGS_WEIGHT */
   int		imaflag_mask;			/* Rej. mask on IMAFLAGS_ISO */
   int		nmax;				/* Max. nb of samples per set*/
+  enum {SAMPLE_PRECISION_FULL, SAMPLE_PRECISION_HALF}
+		sample_precision;		/* Weight/residual storage */
+  int		samplecache_flag;		/* Keep samples between passes?*/
   double	prof_accuracy;			/* Required PSF accuracy */
   double	psf_step;			/* Oversampling (pixels) */
   double	psf_pixsize[2];			/* Eff. pixel size (pixels) */
@@ -95,6 +98,11 @@ typedef struct
   int		basis_number;			/* nb of supersampled pixels */
   char		basis_name[MAXCHAR];		/* PSF vector basis filename */
   double	basis_scale;			/* Gauss-Laguerre beta param */
+  double	basis_shiftstep;		/* Basis shift lattice step */
+  enum {SHIFTINTERP_NEAREST, SHIFTINTERP_BILINEAR}
+		basis_shiftinterp;		/* Basis shift interpolation */
+  enum {SOLVER_AUTO, SOLVER_DENSE, SOLVER_SPARSE, SOLVER_CG}
+		refine_solver;			/* PSF refinement solver */
 /* Re-centering */
   char		*(center_key[2]);		/* Names of centering keys */
   int		ncenter_key;			/* nb of params */
@@ -45,11 +45,25 @@
 #define	PSF_NMASKDIM	3	/* Number of dimensions for PSF data */
 #define	PSF_MAXSHIFT	3.0	/* Max shift from initial guess (pixels)*/
 #define	PSF_MINSHIFT	1e-4	/* Min shift from previous guess (pixels)*/
+#define	PSF_LINSHIFT	0.25	/* Max shift from linearisation (pixels) */
 #define PSF_NITER	40	/* Maximum number of iterations in fit */
 #define	PSF_NSNAPMAX	16	/* Maximum number of PSF snapshots/dimension */
 #define	GAUSS_LAG_OSAMP	3	/* Gauss-Laguerre oversampling factor */
 #define	PSF_AUTO_FWHM	3.0	/* FWHM theshold for PIXEL-AUTO mode */
 #define	PSF_NORTHOSTEP	16	/* Number of PSF orthonor. snapshots/dimension*/
+#define	PSF_NPIXBATCH	256	/* Number of PSF pixels fitted at once */
+#define	PSF_KRONMIN	64	/* Min. nb of unknowns for BLAS refinement */
+#define	PSF_KRONBATCH	32	/* Nb of samples per BLAS refinement batch */
+#define	PSF_SPARSEFRAC	0.25	/* Max. sparse/dense cost for auto solver */
+#define	PSF_CGTOL	1e-10	/* Relative residual for the CG refinement */
+#define	PSF_CGMAXITER	2000	/* Max. nb of CG refinement iterations */
+#define	PSF_UPDATEFRAC	0.5	/* Max. changed sample fraction for updates */
+#define	PSF_SHIFTMAXMEM	1.0e9	/* Max. size of the basis shift cache (bytes)*/
+#define	PSF_ACCUMMAXMEM	1.0e9	/* Max. size of extra normal matrices (bytes)*/
+
+#define	PSF_RESI_CENTER	1	/* psf_makeresi() task: recentering */
+#define	PSF_RESI_SAMPLE	2	/* psf_makeresi() task: sample residuals */
+#define	PSF_RESI_REDUCE	3	/* psf_makeresi() task: residual map */
 
 /*----------------------------- Type definitions --------------------------*/
 typedef enum {BASIS_NONE, BASIS_PIXEL, BASIS_GAUSS_LAGUERRE, BASIS_FILE,
@@ -57,6 +71,67 @@ typedef enum {BASIS_NONE, BASIS_PIXEL, BASIS_GAUSS_LAGUERRE, BASIS_FILE,
         basistypenum;
 /*--------------------------- structure definitions -------------------------*/
 
+typedef struct refinecg
+  {
+  double	**val;		/* Design matrix values (one array per sample) */
+  int		**index;	/* Vignet pixel indices (one array per sample) */
+  int		**row;		/* Row starts (npsf+1 per sample) */
+  double	*coeff;		/* Context coefficients (ncoeff per sample) */
+  int		nsample;	/* Number of samples */
+  int		npsf;		/* Number of basis vectors */
+  int		ncoeff;		/* Number of context coefficients */
+  int		nvpix;		/* Number of pixels in sample vignets */
+  }	refinecgstruct;
+
+typedef struct refinekey
+  {
+  int		catindex;	/* Catalogue index of the sample */
+  int		extindex;	/* Extension index of the sample */
+  int		objindex;	/* Object index of the sample */
+  int		index;		/* Index of the sample in the design data */
+  float		dx,dy;		/* Sample shift used in the design matrix */
+  float		norm;		/* Sample normalisation */
+  }	refinekeystruct;
+
+typedef struct refinecache
+  {
+  refinecgstruct	cg;		/* Design data of the included samples */
+  refinekeystruct	*key;		/* Sorted sample keys */
+  double	*alphamat;	/* Normal matrix (not regularised) */
+  size_t	nalpha;		/* Number of elements in the normal matrix */
+  double	*contextoffset;	/* Context offsets used in the design matrix */
+  double	*contextscale;	/* Context scales used in the design matrix */
+  int		ncontext;	/* Number of contexts */
+  float		*basis;		/* Basis vectors used in the design matrix */
+  }	refinecachestruct;
+
+typedef struct shiftcache
+  {
+  float		*vec;		/* Resampled basis vectors, node by node */
+  int		*node;		/* Node index of lattice points (-1 = none) */
+  double	step;		/* Lattice step (vignet pixels) */
+  float		pixstep;	/* PSF pixel step of the resampled vectors */
+  int		ix0,iy0;	/* Lattice origin (in steps) */
+  int		nx,ny;		/* Lattice size */
+  int		nnode;		/* Number of computed nodes */
+  int		interp;		/* Node interpolation (SHIFTINTERP_*) */
+  int		npsf;		/* Number of basis vectors per node */
+  int		w,h;		/* Vignet size */
+  }	shiftcachestruct;
+
+typedef struct makeresi
+  {
+  struct psf	*psf;		/* PSF (with its own psf->loc workspace) */
+  setstruct	*set;		/* Sample set */
+  double	*dx,*dy;	/* Sample shifts for the residuals */
+  int		*okflag;	/* Recentering convergence flags */
+  int		*index;		/* Indices of the samples to process */
+  double	*dresi;		/* Residual map */
+  double	prof_accuracy;	/* PSF accuracy parameter */
+  int		nstart,nend;	/* Range of samples (or vignet lines) */
+  int		task;		/* Task to be run (threaded mode) */
+  }	makeresistruct;
+
 typedef struct moffat
   {
   double	context[POLY_MAXDIM];	/* Context coordinates */
@@ -158,6 +233,9 @@ typedef struct psf
   float		*homo_kernel;		/* PSF homogenization kernel */
   double	homopsf_params[2];	/* Idealised Moffat PSF params*/
   int		homobasis_number;	/* nb of supersampled pixels */
+  unsigned int	gen;		/* Model generation (bumped on changes) */
+  refinecachestruct	*refinecache;	/* Normal equations of last refinement*/
+  shiftcachestruct	*shiftcache;	/* Resampled basis vectors by shift */
   }	psfstruct;
 
 
@@ -172,6 +250,7 @@ extern void	psf_build(psfstruct *psf, double *pos),
 			double prof_accuracy),
 		psf_makemask(psfstruct *psf, setstruct *set, double chithresh),
 		psf_orthopoly(psfstruct *psf, setstruct *set),
+		psf_refine_end(psfstruct *psf),
 		psf_save(psfstruct *psf,  char *filename, int ext, int next);
 
 extern int	psf_pshapelet(float **shape, int w, int h, int nmax,
@@ -180,7 +259,9 @@ extern int	psf_pshapelet(float **shape, int w, int h, int nmax,
 		psf_refine(psfstruct *psf, setstruct *set);
 
 extern double	psf_chi2(psfstruct *psf, setstruct *set),
-		psf_clean(psfstruct *psf, setstruct *set, double prof_accuracy);
+		psf_clean(psfstruct *psf, setstruct *set, double prof_accuracy),
+		psf_sparsedot(const double *val, const int *index, int n,
+			const double *vec);
 
 extern psfstruct	*psf_copy(psfstruct *psf),
 			*psf_inherit(contextstruct *context, psfstruct *psf),
@@ -41,9 +41,26 @@
 #define	RECENTER_OVERSAMP	3	/* Oversampling for recentering */
 #define	RECENTER_STEPMIN	0.001	/* Min. recentering coordinate update */
 #define	RECENTER_GRADFAC	2.0	/* Gradient descent accel. factor */
+#define	SAMPLE_MASKBITS		32	/* Bits per rejection mask word */
+#define	SAMPLE_ARENASHRINK	0.75	/* Min. used fraction of the arena */
+
+/*-------------------------------- macros -----------------------------------*/
+
+#define	SAMPLE_VIGSTRIDE(n)	((((n)*sizeof(float)+63)/64)*64/sizeof(float))
+#define	SAMPLE_VIGSTRIDEH(n)	((((n)*sizeof(unsigned short)+63)/64)*64 \
+				/sizeof(unsigned short))
+#define	SAMPLE_REJECTED(set, n)	((set)->rejmask \
+		&& ((set)->rejmask[(n)/SAMPLE_MASKBITS]>>((n)%SAMPLE_MASKBITS) & 1))
 
 /*--------------------------- structure definitions -------------------------*/
 
+/*
+ In half-precision sets (set->halfflag), vigweight, vigresi and vigchi are NULL
+ and the planes are stored in vigweighth, vigresih and vigchih instead, with
+ the weightfac, resifac and chifac decoding factors. Weight-maps must then be
+ written through make_weights(), which encodes them; code that fills sample
+ planes directly after malloc_samples() must use full-precision sets.
+*/
 typedef struct sample
   {
   int		catindex;		/* Catalogue index */
@@ -53,6 +70,19 @@ typedef struct sample
   float		*vigresi;		/* Residual-map of the PSF-residuals */
   float		*vigchi;		/* Chi-map of the PSF-residuals */
   float		*vigweight;		/* Vignette-weight array */
+  unsigned short *vigresih;		/* Half-precision vigresi (or NULL) */
+  unsigned short *vigchih;		/* Half-precision vigchi (or NULL) */
+  unsigned short *vigweighth;		/* Half-precision vigweight (or NULL)*/
+  float		resifac,chifac,weightfac;/* Half-precision decoding factors */
+  float		*vigpsf;		/* Vignette resampled to the PSF grid */
+  float		*vigpsfnoise;		/* Accuracy-independent noise of vigpsf*/
+  int		vigpsfsize[2];		/* Dimensions of vigpsf */
+  float		psfdx,psfdy;		/* x,y shift used for vigpsf */
+  float		psfnorm;		/* Normalisation used for vigpsf */
+  float		psfstep;		/* PSF pixel step of vigpsf (0=invalid) */
+  unsigned int	resigen;		/* PSF generation of vigresi (0=none) */
+  double	resiaccu;		/* PSF accuracy used for vigresi */
+  float		residx,residy;		/* x,y shift used for vigresi */
   float		norm;			/* Normalisation */
   double	x,y;			/* x,y position estimate in frame */
   float		dx,dy;			/* x,y shift / vignet center */
@@ -63,14 +93,36 @@ typedef struct sample
   double	*context;		/* Context vector */
   }	samplestruct;
 
+typedef struct samplestate
+  {
+  struct sample	*sample;		/* Sample */
+  float		dx,dy;			/* x,y shift / vignet center */
+  int		objindex;		/* Object index */
+  }	samplestatestruct;
+
 typedef struct set
   {
   char		*head;			/* Table structure */
   struct sample	**sample;		/* Array of samples */
   struct sample	*s_sample;		/* Memory for array of samples */
+  float		*s_vig;			/* Arena of vignettes */
+  float		*s_vigresi;		/* Arena (or pool) of residual-maps */
+  float		*s_vigweight;		/* Arena of vignette-weights */
+  float		*s_vigchi;		/* Arena (or pool) of chi-maps */
+  unsigned short *s_vigresih;		/* Half-precision s_vigresi */
+  unsigned short *s_vigweighth;		/* Half-precision s_vigweight */
+  unsigned short *s_vigchih;		/* Half-precision s_vigchi */
+  int		halfflag;		/* Half-precision weights/residuals? */
+  double	*s_context;		/* Arena of context vectors */
+  int		nsamplearena;		/* Number of samples in the arena */
+  int		nvigstride;		/* Vignette stride in the arena */
+  int		nvigstrideh;		/* Half-precision plane stride */
+  unsigned int	*rejmask;		/* Bit mask of rejected samples */
   int		nsample;		/* Number of samples in stack */
   int		nsamplemax;		/* Max number of samples in stack */
   struct set    *samples_owner;         /* set which owns the samples and will need to free them */
+  struct samplestate *viewstate;	/* Sample states to restore (views) */
+  int		nviewstate;		/* Number of sample states */
   int		*vigsize;		/* Dimensions of vignette frames */
   int		vigdim;			/* Dimensionality of the vignette */
   int		nvig;			/* Number of pixels of the vignette */
@@ -89,25 +141,46 @@ typedef struct set
   int		badpix;			/* # discarded with too many bad pix. */
   }	setstruct;
 
+typedef struct samplecache
+  {
+  struct set	*set;			/* Cached set (owns its samples) */
+  contextstruct	*context;		/* Context of the set */
+  int		catindex;		/* Index of the first catalogue */
+  int		ncat;			/* Number of catalogues */
+  int		ext;			/* Extension (or ALL_EXTENSIONS) */
+  struct samplecache *nextcache;	/* Next cached set */
+  }	samplecachestruct;
+
 /*-------------------------------- protos -----------------------------------*/
 
 samplestruct	*remove_sample(setstruct *set, int isample);
 
+int		compact_samples(setstruct *set);
+
 setstruct	*init_set(contextstruct *context),
+		*view_set(setstruct *set, int catindex, int ncat, int ext,
+			contextstruct *context),
 		*load_samples(char **filename, int catindex, int ncat,
 			int ext, int next, contextstruct *context),
+		*load_cachedsamples(samplecachestruct **cache,
+			char **filename, int catindex, int ncat,
+			int ext, int next, contextstruct *context),
 		*read_samples(setstruct *set, char *filename,
 			float frmin, float frmax,
 			int ext, int next, int catindex,
 			contextstruct *context, double *pcval);
 
-void		end_set(setstruct *set),
+void		arena_samples(setstruct *set, int nsample),
+		end_samplecache(samplecachestruct *cache),
+		end_set(setstruct *set),
 		free_samples(setstruct *set),
  		malloc_samples(setstruct *set, int nsample),
 		make_weights(setstruct *set, samplestruct *sample),
+		malloc_resisamples(setstruct *set, int chiflag),
 		realloc_samples(setstruct *set, int nsample),
 		recenter_sample(samplestruct *sample, setstruct *set,
-			float fluxrad);
+			float fluxrad),
+		reject_sample(setstruct *set, int isample);
 
 #endif
 
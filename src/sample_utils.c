@@ -27,6 +27,10 @@
 *
 *%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
 
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L	/* posix_memalign() (see QMALLOC64) */
+#endif
+
 #ifdef HAVE_CONFIG_H
 #include	"config.h"
 #endif
@@ -41,6 +45,7 @@
 
 #include        "define.h"
 #include        "globals.h"
+#include        "misc.h"
 #include        "prefs.h"
 
 /*****************************************************************************/
@@ -55,9 +60,10 @@ PURPOSE Allocate memory for a set of samples.
 INPUT   set structure pointer,
         desired number of samples.
 OUTPUT  -.
-NOTES   -.
+NOTES   Vignette planes and contexts are stored in the sample arena (see
+        arena_samples()).
 AUTHOR  E. Bertin (IAP, Leiden observatory & ESO)
-VERSION 26/03/2008
+VERSION 18/10/2026
 */
 void	malloc_samples(setstruct *set, int nsample)
 
@@ -74,13 +80,11 @@ void	malloc_samples(setstruct *set, int nsample)
   for (n=0; n!=nsample; ++n)
     {
     sample = set->sample[n] = &set->s_sample[n];
-    QMALLOC(sample->vig, float, set->nvig);
-    QMALLOC(sample->vigresi, float, set->nvig);
-    QMALLOC(sample->vigweight, float, set->nvig);
-    QMALLOC(sample->vigchi, float, set->nvig);
-    if (set->ncontext)
-      QMALLOC(sample->context, double, set->ncontext);
+    sample->vigpsf = sample->vigpsfnoise = NULL;
+    sample->psfstep = 0.0;
+    sample->resigen = 0;
     }
+  arena_samples(set, nsample);
 
   return;
   }
@@ -92,9 +96,10 @@ PURPOSE Re-allocate memory for a set of samples.
 INPUT   set structure pointer,
         desired number of samples.
 OUTPUT  -.
-NOTES   -.
+NOTES   The sample arena is only shrunk when most of it becomes unused (see
+        arena_samples()).
 AUTHOR  E. Bertin (IAP, Leiden observatory & ESO)
-VERSION 26/03/2008
+VERSION 18/10/2026
 */
 void	realloc_samples(setstruct *set, int nsample)
 
@@ -121,12 +126,9 @@ void	realloc_samples(setstruct *set, int nsample)
     for (n = set->nsamplemax; n<nsample; n++)
       {
       sample = &set->s_sample[n];
-      QMALLOC(sample->vig, float, set->nvig);
-      QMALLOC(sample->vigresi, float, set->nvig);
-      QMALLOC(sample->vigchi, float, set->nvig);
-      QMALLOC(sample->vigweight, float, set->nvig);
-      if (set->ncontext)
-        QMALLOC(sample->context, double, set->ncontext);
+      sample->vigpsf = sample->vigpsfnoise = NULL;
+      sample->psfstep = 0.0;
+      sample->resigen = 0;
       }
     }
   else if (nsample<set->nsamplemax)
@@ -134,12 +136,8 @@ void	realloc_samples(setstruct *set, int nsample)
     for (n = nsample; n<set->nsamplemax; n++)
       {
       sample = &set->s_sample[n];
-      free(sample->vig);
-      free(sample->vigresi);
-      free(sample->vigchi);
-      free(sample->vigweight);
-      if (set->ncontext)
-        free(sample->context);
+      free(sample->vigpsf);
+      free(sample->vigpsfnoise);
       }
     QREALLOC(set->s_sample, samplestruct, nsample);
     free(set->sample);
@@ -151,6 +149,284 @@ void	realloc_samples(setstruct *set, int nsample)
   for (n = 0; n<nsample; n++)
      set->sample[n] = &set->s_sample[n];
 
+  arena_samples(set, nsample);
+
+  return;
+  }
+
+
+/****** arena_samples ********************************************************
+PROTO   void arena_samples(setstruct *set, int nsample)
+PURPOSE Resize the sample arena and point the samples to their storage.
+INPUT   set structure pointer,
+        number of samples.
+OUTPUT  -.
+NOTES   Each of the vig and vigweight planes of all samples is stored in one
+        contiguous slab, with a stride of set->nvigstride floats that keeps
+        every vignette aligned on 64 bytes. Contexts are stored as a
+        nsample x ncontext matrix. The vigresi and vigchi slabs are only
+        present once allocated by malloc_resisamples(); sample planes are
+        NULL otherwise. If set->halfflag is set, the vigweight, vigresi and
+        vigchi planes are replaced with their half-precision counterparts,
+        with a stride of set->nvigstrideh. Sample n (in s_sample order)
+        always uses row n of the arena. The arena grows as needed, and is
+        shrunk only when less than SAMPLE_ARENASHRINK of it would be used,
+        so that removing samples one at a time does not copy it.
+AUTHOR  LSST DM (Rubin Observatory)
+VERSION 18/10/2026
+*/
+void	arena_samples(setstruct *set, int nsample)
+
+  {
+   samplestruct	*sample;
+   float	*vig, *vigresi, *vigweight, *vigchi;
+   unsigned short	*vigresih, *vigweighth, *vigchih;
+   double	*context;
+   size_t	nold, nnew, noldh, nnewh;
+   int		n, ncopy;
+
+  if (nsample>set->nsamplearena
+	|| (nsample && nsample<SAMPLE_ARENASHRINK*set->nsamplearena))
+    {
+    vig = vigresi = vigweight = vigchi = NULL;	/* To avoid gcc -Wall warnings*/
+    vigresih = vigweighth = vigchih = NULL;
+    context = NULL;
+    if (!set->nsamplearena)
+      {
+      set->nvigstride = SAMPLE_VIGSTRIDE(set->nvig);
+      set->nvigstrideh = SAMPLE_VIGSTRIDEH(set->nvig);
+      }
+    ncopy = nsample<set->nsamplearena? nsample : set->nsamplearena;
+    nold = (size_t)ncopy*set->nvigstride;
+    nnew = (size_t)nsample*set->nvigstride;
+    noldh = (size_t)ncopy*set->nvigstrideh;
+    nnewh = (size_t)nsample*set->nvigstrideh;
+    QMALLOC64(vig, float, nnew);
+    if (set->halfflag)
+      {
+      QMALLOC64(vigweighth, unsigned short, nnewh);
+      }
+    else
+      {
+      QMALLOC64(vigweight, float, nnew);
+      }
+    if (set->s_vigresi)
+      QMALLOC64(vigresi, float, nnew);
+    if (set->s_vigchi)
+      QMALLOC64(vigchi, float, nnew);
+    if (set->s_vigresih)
+      QMALLOC64(vigresih, unsigned short, nnewh);
+    if (set->s_vigchih)
+      QMALLOC64(vigchih, unsigned short, nnewh);
+    if (nold)
+      {
+      memcpy(vig, set->s_vig, nold*sizeof(float));
+      if (vigweight)
+        memcpy(vigweight, set->s_vigweight, nold*sizeof(float));
+      if (vigresi)
+        memcpy(vigresi, set->s_vigresi, nold*sizeof(float));
+      if (vigchi)
+        memcpy(vigchi, set->s_vigchi, nold*sizeof(float));
+      if (vigweighth)
+        memcpy(vigweighth, set->s_vigweighth, noldh*sizeof(unsigned short));
+      if (vigresih)
+        memcpy(vigresih, set->s_vigresih, noldh*sizeof(unsigned short));
+      if (vigchih)
+        memcpy(vigchih, set->s_vigchih, noldh*sizeof(unsigned short));
+      }
+    free(set->s_vig);
+    free(set->s_vigresi);
+    free(set->s_vigweight);
+    free(set->s_vigchi);
+    free(set->s_vigresih);
+    free(set->s_vigweighth);
+    free(set->s_vigchih);
+    set->s_vig = vig;
+    set->s_vigresi = vigresi;
+    set->s_vigweight = vigweight;
+    set->s_vigchi = vigchi;
+    set->s_vigresih = vigresih;
+    set->s_vigweighth = vigweighth;
+    set->s_vigchih = vigchih;
+    if (set->ncontext)
+      {
+      QMALLOC64(context, double, (size_t)nsample*set->ncontext);
+      if (ncopy)
+        memcpy(context, set->s_context,
+		(size_t)ncopy*set->ncontext*sizeof(double));
+      free(set->s_context);
+      set->s_context = context;
+      }
+    set->nsamplearena = nsample;
+    }
+
+  for (n=0; n<nsample; n++)
+    {
+    sample = &set->s_sample[n];
+    sample->vig = set->s_vig + (size_t)n*set->nvigstride;
+    sample->vigweight = set->s_vigweight?
+		set->s_vigweight + (size_t)n*set->nvigstride : NULL;
+    sample->vigresi = set->s_vigresi?
+		set->s_vigresi + (size_t)n*set->nvigstride : NULL;
+    sample->vigchi = set->s_vigchi?
+		set->s_vigchi + (size_t)n*set->nvigstride : NULL;
+    sample->vigweighth = set->s_vigweighth?
+		set->s_vigweighth + (size_t)n*set->nvigstrideh : NULL;
+    sample->vigresih = set->s_vigresih?
+		set->s_vigresih + (size_t)n*set->nvigstrideh : NULL;
+    sample->vigchih = set->s_vigchih?
+		set->s_vigchih + (size_t)n*set->nvigstrideh : NULL;
+    sample->context = set->ncontext?
+		set->s_context + (size_t)n*set->ncontext : NULL;
+    }
+
+  return;
+  }
+
+
+/****** malloc_resisamples ***************************************************
+PROTO   void malloc_resisamples(setstruct *set, int chiflag)
+PURPOSE Make sure that the samples of a set have residual (and chi) planes.
+INPUT   set structure pointer,
+        flag for chi-maps (0=no).
+OUTPUT  -.
+NOTES   Residual and chi-map planes are only allocated when a residual pass
+        needs them. In the set that owns the samples they are added to the
+        sample arena. Sets that only point to the samples of other sets give
+        the samples that still lack them rows in a pool of their own, which
+        is released by free_samples(). The residuals of samples that get new
+        planes are marked as stale. Planes are half-precision if
+        set->halfflag is set.
+AUTHOR  LSST DM (Rubin Observatory)
+VERSION 18/10/2026
+*/
+void	malloc_resisamples(setstruct *set, int chiflag)
+
+  {
+   samplestruct	*sample;
+   size_t	npool, npoolh;
+   int		n, nstride, nstrideh;
+
+  if (set == set->samples_owner)
+    {
+    if ((set->s_vigresi || set->s_vigresih)
+	&& (set->s_vigchi || set->s_vigchih || !chiflag))
+      return;
+    npool = (size_t)set->nsamplearena*set->nvigstride;
+    npoolh = (size_t)set->nsamplearena*set->nvigstrideh;
+    if (set->halfflag)
+      {
+      if (!set->s_vigresih)
+        QMALLOC64(set->s_vigresih, unsigned short, npoolh? npoolh : 1);
+      if (chiflag && !set->s_vigchih)
+        QMALLOC64(set->s_vigchih, unsigned short, npoolh? npoolh : 1);
+      }
+    else
+      {
+      if (!set->s_vigresi)
+        QMALLOC64(set->s_vigresi, float, npool? npool : 1);
+      if (chiflag && !set->s_vigchi)
+        QMALLOC64(set->s_vigchi, float, npool? npool : 1);
+      }
+    for (n=0; n<set->nsamplemax; n++)
+      set->s_sample[n].resigen = 0;
+    arena_samples(set, set->nsamplemax);
+    return;
+    }
+
+/* Samples owned by other sets */
+  if (!set->nvigstride)
+    {
+    set->nvigstride = SAMPLE_VIGSTRIDE(set->vigsize[0]*set->vigsize[1]);
+    set->nvigstrideh = SAMPLE_VIGSTRIDEH(set->vigsize[0]*set->vigsize[1]);
+    }
+  nstride = set->nvigstride;
+  nstrideh = set->nvigstrideh;
+  npool = (size_t)set->nsamplemax*nstride;
+  npoolh = (size_t)set->nsamplemax*nstrideh;
+  for (n=0; n<set->nsample; n++)
+    {
+    sample = set->sample[n];
+    if (!sample->vigresi && !sample->vigresih)
+      {
+      if (set->halfflag)
+        {
+        if (!set->s_vigresih)
+          QMALLOC64(set->s_vigresih, unsigned short, npoolh? npoolh : 1);
+        sample->vigresih = set->s_vigresih + (size_t)n*nstrideh;
+        }
+      else
+        {
+        if (!set->s_vigresi)
+          QMALLOC64(set->s_vigresi, float, npool? npool : 1);
+        sample->vigresi = set->s_vigresi + (size_t)n*nstride;
+        }
+      sample->resigen = 0;
+      }
+    if (chiflag && !sample->vigchi && !sample->vigchih)
+      {
+      if (set->halfflag)
+        {
+        if (!set->s_vigchih)
+          QMALLOC64(set->s_vigchih, unsigned short, npoolh? npoolh : 1);
+        sample->vigchih = set->s_vigchih + (size_t)n*nstrideh;
+        }
+      else
+        {
+        if (!set->s_vigchi)
+          QMALLOC64(set->s_vigchi, float, npool? npool : 1);
+        sample->vigchi = set->s_vigchi + (size_t)n*nstride;
+        }
+      sample->resigen = 0;
+      }
+    }
+
+  return;
+  }
+
+
+/****** unpool_sample *********************************************************
+PROTO   void unpool_sample(setstruct *set, samplestruct *sample)
+PURPOSE Detach a sample from the residual pool of a set that does not own it.
+INPUT   set structure pointer,
+        sample structure pointer.
+OUTPUT  -.
+NOTES   See malloc_resisamples().
+AUTHOR  LSST DM (Rubin Observatory)
+VERSION 18/10/2026
+*/
+static void	unpool_sample(setstruct *set, samplestruct *sample)
+
+  {
+   size_t	npool, npoolh;
+
+  npool = (size_t)set->nsamplemax*set->nvigstride;
+  npoolh = (size_t)set->nsamplemax*set->nvigstrideh;
+  if (set->s_vigresi && sample->vigresi >= set->s_vigresi
+	&& sample->vigresi < set->s_vigresi + npool)
+    {
+    sample->vigresi = NULL;
+    sample->resigen = 0;
+    }
+  if (set->s_vigchi && sample->vigchi >= set->s_vigchi
+	&& sample->vigchi < set->s_vigchi + npool)
+    {
+    sample->vigchi = NULL;
+    sample->resigen = 0;
+    }
+  if (set->s_vigresih && sample->vigresih >= set->s_vigresih
+	&& sample->vigresih < set->s_vigresih + npoolh)
+    {
+    sample->vigresih = NULL;
+    sample->resigen = 0;
+    }
+  if (set->s_vigchih && sample->vigchih >= set->s_vigchih
+	&& sample->vigchih < set->s_vigchih + npoolh)
+    {
+    sample->vigchih = NULL;
+    sample->resigen = 0;
+    }
+
   return;
   }
 
@@ -163,7 +439,7 @@ INPUT   set structure pointer,
 OUTPUT  -.
 NOTES   -.
 AUTHOR  E. Bertin (IAP, Leiden observatory & ESO)
-VERSION 26/03/2008
+VERSION 18/10/2026
 */
 void	free_samples(setstruct *set)
 
@@ -176,15 +452,38 @@ void	free_samples(setstruct *set)
      for (n = 0; n<set->nsamplemax; ++n )
        {
        sample = set->sample[n];
-       free(sample->vig);
-       free(sample->vigresi);
-       free(sample->vigweight);
-       free(sample->vigchi);
-       if (set->ncontext)
-	 free(sample->context);
+       free(sample->vigpsf);
+       free(sample->vigpsfnoise);
        }
      free(set->s_sample);
+     set->s_sample = NULL;
+     free(set->s_vig);
+     free(set->s_vigresi);
+     free(set->s_vigweight);
+     free(set->s_vigchi);
+     free(set->s_vigresih);
+     free(set->s_vigweighth);
+     free(set->s_vigchih);
+     free(set->s_context);
+     set->s_vig = set->s_vigresi = set->s_vigweight = set->s_vigchi = NULL;
+     set->s_vigresih = set->s_vigweighth = set->s_vigchih = NULL;
+     set->s_context = NULL;
+     set->nsamplearena = 0;
      }
+   else if (set->s_vigresi || set->s_vigchi
+	|| set->s_vigresih || set->s_vigchih)
+     {
+     for (n = 0; n<set->nsample; ++n)
+       unpool_sample(set, set->sample[n]);
+     free(set->s_vigresi);
+     free(set->s_vigchi);
+     free(set->s_vigresih);
+     free(set->s_vigchih);
+     set->s_vigresi = set->s_vigchi = NULL;
+     set->s_vigresih = set->s_vigchih = NULL;
+     }
+  free(set->rejmask);
+  set->rejmask = NULL;
 
   free(set->sample);
   set->sample = NULL;
@@ -199,35 +498,144 @@ PROTO   samplestruct *remove_sample(setstruct *set, int isample)
 PURPOSE Remove an element from a set of samples.
 INPUT   set structure pointer,
         sample number.
-OUTPUT  The new pointer for the element that replaced the removed one.
-NOTES   -.
+OUTPUT  The new pointer for the element that replaced the removed one (NULL if
+        the removed sample was the last one).
+NOTES   The order of the remaining samples is preserved. To remove many
+        samples, flag them with reject_sample() and call compact_samples()
+        once.
 AUTHOR  E. Bertin (IAP, Leiden observatory & ESO)
-VERSION 01/03/99
+VERSION 18/10/2026
 */
 samplestruct	*remove_sample(setstruct *set, int isample)
 
   {
-   static samplestruct	exsample;
-   samplestruct		*sample;
-   int			nsample;
+  reject_sample(set, isample);
+  compact_samples(set);
 
-/* If we want to reallocate 0 samples, better free the whole thing! */
-  nsample = set->nsample-1;
-  if (nsample>0)
-    {
-    sample = set->sample[isample];
+  return isample<set->nsample? set->sample[isample] : NULL;
+  }
+
+
+/****** reject_sample ********************************************************
+PROTO   void reject_sample(setstruct *set, int isample)
+PURPOSE Flag a sample for removal by the next compact_samples() call.
+INPUT   set structure pointer,
+        sample number.
+OUTPUT  -.
+NOTES   The sample stays in place (with an objindex of -1) until the set is
+        compacted; no sample may be added in the meantime.
+AUTHOR  LSST DM (Rubin Observatory)
+VERSION 18/10/2026
+*/
+void	reject_sample(setstruct *set, int isample)
+
+  {
+  if (!set->rejmask)
+    QCALLOC(set->rejmask, unsigned int,
+	(set->nsample+SAMPLE_MASKBITS-1)/SAMPLE_MASKBITS);
+  set->rejmask[isample/SAMPLE_MASKBITS] |= 1U<<(isample%SAMPLE_MASKBITS);
 /* Set the object index to -1 so we know that it has been rejected */
-    sample->objindex = -1;
-    exsample = *set->sample[nsample];
-    *set->sample[nsample] = *sample;
-    *sample = exsample;
+  set->sample[isample]->objindex = -1;
+
+  return;
+  }
+
+
+/****** compact_samples ******************************************************
+PROTO   int compact_samples(setstruct *set)
+PURPOSE Physically remove the samples flagged by reject_sample().
+INPUT   set structure pointer.
+OUTPUT  Number of samples removed.
+NOTES   Remaining samples keep their order. In the set that owns the samples,
+        their data are moved down the arena (see arena_samples()); other sets
+        only compact their array of sample pointers. The sample array is
+        reallocated once.
+AUTHOR  LSST DM (Rubin Observatory)
+VERSION 18/10/2026
+*/
+int	compact_samples(setstruct *set)
+
+  {
+   samplestruct	*sample, *sample2;
+   float	*vig, *vigresi, *vigweight, *vigchi;
+   unsigned short	*vigresih, *vigweighth, *vigchih;
+   double	*context;
+   int		n,n2, nsample, nvig, ownerflag;
+
+  if (!set->rejmask)
+    return 0;
+
+  nsample = set->nsample;
+  nvig = set->nvig;
+  ownerflag = (set == set->samples_owner);
+  for (n=n2=0; n<nsample; n++)
+    {
+    sample = set->sample[n];
+    if (SAMPLE_REJECTED(set, n))
+      {
+      if (ownerflag)
+        {
+        free(sample->vigpsf);
+        free(sample->vigpsfnoise);
+        sample->vigpsf = sample->vigpsfnoise = NULL;
+        }
+      else
+        unpool_sample(set, sample);
+      continue;
+      }
+    if (n2!=n)
+      {
+      if (ownerflag)
+        {
+/*------ Move the sample to row n2 of the arena */
+        sample2 = set->sample[n2];
+        vig = sample2->vig;
+        vigresi = sample2->vigresi;
+        vigweight = sample2->vigweight;
+        vigchi = sample2->vigchi;
+        vigresih = sample2->vigresih;
+        vigweighth = sample2->vigweighth;
+        vigchih = sample2->vigchih;
+        context = sample2->context;
+        *sample2 = *sample;
+        sample2->vig = vig;
+        sample2->vigresi = vigresi;
+        sample2->vigweight = vigweight;
+        sample2->vigchi = vigchi;
+        sample2->vigresih = vigresih;
+        sample2->vigweighth = vigweighth;
+        sample2->vigchih = vigchih;
+        sample2->context = context;
+        memcpy(vig, sample->vig, nvig*sizeof(float));
+        if (vigweight)
+          memcpy(vigweight, sample->vigweight, nvig*sizeof(float));
+        if (vigresi)
+          memcpy(vigresi, sample->vigresi, nvig*sizeof(float));
+        if (vigchi)
+          memcpy(vigchi, sample->vigchi, nvig*sizeof(float));
+        if (vigweighth)
+          memcpy(vigweighth, sample->vigweighth, nvig*sizeof(unsigned short));
+        if (vigresih)
+          memcpy(vigresih, sample->vigresih, nvig*sizeof(unsigned short));
+        if (vigchih)
+          memcpy(vigchih, sample->vigchih, nvig*sizeof(unsigned short));
+        if (set->ncontext)
+          memcpy(context, sample->context, set->ncontext*sizeof(double));
+/*------ The cached PSF vignettes now belong to row n2 */
+        sample->vigpsf = sample->vigpsfnoise = NULL;
+        }
+      else
+        set->sample[n2] = sample;
+      }
+    n2++;
     }
-   else
-     nsample=0;
-  realloc_samples(set, nsample);
-  set->nsample = nsample;
 
-  return set->sample[isample];
+  free(set->rejmask);
+  set->rejmask = NULL;
+  realloc_samples(set, n2);
+  set->nsample = n2;
+
+  return nsample - n2;
   }
 
 
@@ -249,6 +657,7 @@ setstruct	*init_set(contextstruct *context)
   QCALLOC(set, setstruct, 1);
   set->nsample = set->nsamplemax = 0;
   set->samples_owner = set;		/* we'll own the samples, so we'll need to free them */
+  set->halfflag = (prefs.sample_precision == SAMPLE_PRECISION_HALF);
   set->vigdim = 2;
   QMALLOC(set->vigsize, int, set->vigdim);
   set->ncontext = context->ncontext;
@@ -270,15 +679,27 @@ PROTO   void end_set(setstruct *set)
 PURPOSE free memory allocated by a complete set structure.
 INPUT   set structure pointer,
 OUTPUT  -.
-NOTES   -.
+NOTES   The shifts and object indices of the samples of a view are restored
+        to their values at the creation of the view (see view_set()).
 AUTHOR  E. Bertin (IAP, Leiden observatory & ESO)
-VERSION 26/03/2008
+VERSION 18/10/2026
 */
 void	end_set(setstruct *set)
 
   {
-   int	i;
+   samplestatestruct	*state;
+   int			i,n;
 
+  if (set->viewstate)
+    {
+    for (state=set->viewstate, n=set->nviewstate; n--; state++)
+      {
+      state->sample->dx = state->dx;
+      state->sample->dy = state->dy;
+      state->sample->objindex = state->objindex;
+      }
+    free(set->viewstate);
+    }
   free_samples(set);
   free(set->vigsize);
   if (set->ncontext)
@@ -296,20 +717,245 @@ void	end_set(setstruct *set)
   }
 
 
+/****** view_set ************************************************************
+PROTO   setstruct *view_set(setstruct *set, int catindex, int ncat, int ext,
+		contextstruct *context)
+PURPOSE Create a set that points to a selection of the samples of another set.
+INPUT   set structure pointer,
+        index of the first catalogue to select,
+        number of catalogues to select,
+        extension to select (or ALL_EXTENSIONS),
+        pointer to the context (the one used for the samples of set).
+OUTPUT  Pointer to the new set.
+NOTES   The new set does not own its samples: only the array of sample
+        pointers is allocated, and no vignette is copied. Samples keep the
+        order they have in set. Context offsets and scales are recomputed
+        from the selected samples, as for a set loaded with the same
+        selection. Recentering and rejection through the view modify the
+        shared samples, but their shifts and object indices are restored
+        when the view is freed with end_set(). Views must be freed before
+        set, and overlapping views in reverse order of creation.
+AUTHOR  LSST DM (Rubin Observatory)
+VERSION 18/10/2026
+*/
+setstruct	*view_set(setstruct *set, int catindex, int ncat, int ext,
+			contextstruct *context)
+
+  {
+   setstruct	*view;
+   samplestruct	*sample;
+   double	*cmin, *cmax,
+		dval;
+   int		i,n, nsample;
+
+  view = init_set(context);
+  view->samples_owner = NULL;
+  view->vigsize[0] = set->vigsize[0];
+  view->vigsize[1] = set->vigsize[1];
+  view->nvig = set->nvig;
+  view->fwhm = set->fwhm;
+
+/* Count the selected samples */
+  nsample = 0;
+  for (n=0; n<set->nsample; n++)
+    {
+    sample = set->sample[n];
+    if (sample->catindex>=catindex && sample->catindex<catindex+ncat
+	&& (ext==ALL_EXTENSIONS || sample->extindex==ext))
+      nsample++;
+    }
+
+  malloc_samples(view, nsample? nsample : 1);
+  for (n=0; n<set->nsample; n++)
+    {
+    sample = set->sample[n];
+    if (sample->catindex>=catindex && sample->catindex<catindex+ncat
+	&& (ext==ALL_EXTENSIONS || sample->extindex==ext))
+      view->sample[view->nsample++] = sample;
+    }
+
+/* Remember the state of the samples, restored by end_set() */
+  QMALLOC(view->viewstate, samplestatestruct, nsample? nsample : 1);
+  view->nviewstate = nsample;
+  for (n=0; n<nsample; n++)
+    {
+    sample = view->sample[n];
+    view->viewstate[n].sample = sample;
+    view->viewstate[n].dx = sample->dx;
+    view->viewstate[n].dy = sample->dy;
+    view->viewstate[n].objindex = sample->objindex;
+    }
+
+/* Context ranges */
+  if (view->ncontext)
+    {
+    QMALLOC(cmin, double, view->ncontext);
+    QMALLOC(cmax, double, view->ncontext);
+    for (i=0; i<view->ncontext; i++)
+      {
+      memcpy(view->contextname[i], set->contextname[i], 80);
+      cmin[i] = BIG;
+      cmax[i] = -BIG;
+      }
+    for (n=0; n<view->nsample; n++)
+      {
+      sample = view->sample[n];
+      for (i=0; i<view->ncontext; i++)
+        {
+        dval = sample->context[i];
+        if (dval<cmin[i])
+          cmin[i] = dval;
+        if (dval>cmax[i])
+          cmax[i] = dval;
+        }
+      }
+    for (i=0; i<view->ncontext; i++)
+      if (view->nsample)
+        {
+        view->contextscale[i] = cmax[i] - cmin[i];
+        view->contextoffset[i] = (cmin[i] + cmax[i])/2.0;
+        }
+      else
+        {
+        view->contextscale[i] = set->contextscale[i];
+        view->contextoffset[i] = set->contextoffset[i];
+        }
+    free(cmin);
+    free(cmax);
+    }
+
+  return view;
+  }
+
+
+/****** load_cachedsamples **************************************************
+PROTO   setstruct *load_cachedsamples(samplecachestruct **cache,
+		char **filename, int catindex, int ncat, int ext, int next,
+		contextstruct *context)
+PURPOSE Load samples through a cache of sets.
+INPUT   Pointer to the cache (pointer to NULL for an empty cache),
+        array of catalog filenames,
+        catalog index,
+        number of catalogs,
+        current extension (or ALL_EXTENSIONS),
+        number of extensions,
+        pointer to the context.
+OUTPUT  Pointer to a view of the cached set (see view_set()).
+NOTES   Sets are loaded with load_samples() the first time a given catalog
+        range, extension and context are requested, and kept until
+        end_samplecache() is called. Unless the FWHM range is selected
+        automatically (SAMPLE_AUTOSELECT Y), sample selection does not depend
+        on the other catalogs and extensions loaded, and a sub-range of a
+        cached set is served as a view of it. Cached sets never share
+        catalogs and extensions: those overlapping a newly loaded set are
+        freed, hence all views of cached sets must have been freed before.
+        Selection criteria are those in prefs, and must not change in the
+        meantime; contexts with principal components that change must not
+        be cached.
+AUTHOR  LSST DM (Rubin Observatory)
+VERSION 18/10/2026
+*/
+setstruct	*load_cachedsamples(samplecachestruct **cache,
+			char **filename, int catindex, int ncat,
+			int ext, int next, contextstruct *context)
+
+  {
+   samplecachestruct	*scache, **pscache;
+   setstruct		*view;
+   int			i;
+
+/* Look for the same selection, or for a cached set that contains it */
+  for (scache=*cache; scache; scache=scache->nextcache)
+    if (scache->catindex==catindex && scache->ncat==ncat && scache->ext==ext
+	&& scache->context==context)
+      break;
+  if (!scache && !prefs.autoselect_flag)
+    for (scache=*cache; scache; scache=scache->nextcache)
+      if (scache->catindex<=catindex
+	&& scache->catindex+scache->ncat>=catindex+ncat
+	&& (scache->ext==ALL_EXTENSIONS || scache->ext==ext)
+	&& scache->context==context)
+        break;
+
+  if (!scache)
+    {
+/*-- Free the cached sets that share samples with the new one */
+    for (pscache=cache; (scache=*pscache);)
+      if (scache->catindex<catindex+ncat
+	&& catindex<scache->catindex+scache->ncat
+	&& (scache->ext==ext || scache->ext==ALL_EXTENSIONS
+		|| ext==ALL_EXTENSIONS))
+        {
+        *pscache = scache->nextcache;
+        end_set(scache->set);
+        free(scache);
+        }
+      else
+        pscache = &scache->nextcache;
+    QCALLOC(scache, samplecachestruct, 1);
+    scache->set = load_samples(filename, catindex, ncat, ext, next, context);
+    scache->context = context;
+    scache->catindex = catindex;
+    scache->ncat = ncat;
+    scache->ext = ext;
+    scache->nextcache = *cache;
+    *cache = scache;
+    }
+
+  view = view_set(scache->set, catindex, ncat, ext, context);
+/* Same context scaling as the loaded set if the selection is the same */
+  if (scache->catindex==catindex && scache->ncat==ncat && scache->ext==ext)
+    for (i=0; i<view->ncontext; i++)
+      {
+      view->contextoffset[i] = scache->set->contextoffset[i];
+      view->contextscale[i] = scache->set->contextscale[i];
+      }
+
+  return view;
+  }
+
+
+/****** end_samplecache *****************************************************
+PROTO   void end_samplecache(samplecachestruct *cache)
+PURPOSE Free a cache of sets and all the samples it contains.
+INPUT   Pointer to the cache.
+OUTPUT  -.
+NOTES   All the views of the cached sets must have been freed before.
+AUTHOR  LSST DM (Rubin Observatory)
+VERSION 18/10/2026
+*/
+void	end_samplecache(samplecachestruct *cache)
+
+  {
+   samplecachestruct	*scache;
+
+  while ((scache=cache))
+    {
+    cache = scache->nextcache;
+    end_set(scache->set);
+    free(scache);
+    }
+
+  return;
+  }
+
+
 /****** make_weights *********************************************************
 PROTO   void make_weights(setstruct *set, samplestruct *sample)
 PURPOSE Produce a weight-map for each sample vignet.
 INPUT   set structure pointer,
         sample structure pointer.
 OUTPUT  -.
-NOTES   -.
+NOTES   Also invalidates the resampled vignette cached by psf_make() and the
+        residuals cached by psf_makeresi(). Half-precision weight-maps are
+        computed in a temporary buffer and then encoded.
 AUTHOR  E. Bertin (IAP,Leiden observatory & ESO)
-VERSION 13/08/2007
+VERSION 18/10/2026
 */
 void make_weights(setstruct *set, samplestruct *sample)
 
   {
-   float	*vig, *vigweight,
+   float	*vig, *vigweight, *weight,
 		backnoise2, gain, noise2, profaccu2, pix;
    int		i;
 
@@ -317,7 +963,13 @@ void make_weights(setstruct *set, samplestruct *sample)
   profaccu2 = prefs.prof_accuracy*prefs.prof_accuracy;
   gain = sample->gain;
   backnoise2 = sample->backnoise2;
-  for (vig=sample->vig, vigweight=sample->vigweight, i=set->nvig; i--;)
+  if (sample->vigweighth)
+    {
+    QMALLOC(weight, float, set->nvig);
+    }
+  else
+    weight = sample->vigweight;
+  for (vig=sample->vig, vigweight=weight, i=set->nvig; i--;)
     {
     if (*vig <= -BIG)
       *(vig++) = *(vigweight++) = 0.0;
@@ -330,6 +982,15 @@ void make_weights(setstruct *set, samplestruct *sample)
       *(vigweight++) = 1.0/noise2;      
       }
     }
+  if (sample->vigweighth)
+    {
+    sample->weightfac = half_encode(weight, sample->vigweighth, set->nvig);
+    free(weight);
+    }
+
+/* The vignette content may have changed */
+  sample->psfstep = 0.0;
+  sample->resigen = 0;
 
   return;
   }
@@ -343,15 +1004,15 @@ INPUT   sample structure pointer,
 	set structure pointer,
 	flux radius.
 OUTPUT  -.
-NOTES   -.
+NOTES   Half-precision weight-maps are decoded to a temporary buffer.
 AUTHOR  E. Bertin (IAP)
-VERSION 16/11/2009
+VERSION 18/10/2026
 */
 void	recenter_sample(samplestruct *sample, setstruct *set, float fluxrad)
 
   {
    double	tv, dxpos, dypos;
-   float	*ima,*imat,*weight,*weightt,
+   float	*ima,*imat,*weight,*weightt, *weightbuf,
 		pix, var, locpix, locarea, sig,twosig2, raper,raper2,
 		offsetx,offsety, mx,my, mx2ph,my2ph,
 		rintlim,rintlim2,rextlim2, scalex,scaley,scale2,
@@ -378,6 +1039,12 @@ void	recenter_sample(samplestruct *sample, setstruct *set, float fluxrad)
 /* Use isophotal centroid as a first guess */
   mx = sample->dx + (float)(w/2);
   my = sample->dy + (float)(h/2);
+  weightbuf = NULL;
+  if (sample->vigweighth)
+    {
+    QMALLOC(weightbuf, float, w*h);
+    half_decode(sample->vigweighth, weightbuf, w*h, sample->weightfac);
+    }
 
   for (i=0; i<RECENTER_NITERMAX; i++)
     {
@@ -399,7 +1066,7 @@ void	recenter_sample(samplestruct *sample, setstruct *set, float fluxrad)
     tv = 0.0;
     dxpos = dypos = 0.0;
     ima = sample->vig;
-    weight = sample->vigweight;
+    weight = weightbuf? weightbuf : sample->vigweight;
     for (y=ymin; y<ymax; y++)
       {
       imat= ima + (pos = y*w + xmin);
@@ -468,6 +1135,7 @@ void	recenter_sample(samplestruct *sample, setstruct *set, float fluxrad)
 
   sample->dx = mx - (float)(w/2);
   sample->dy = my - (float)(h/2);
+  free(weightbuf);
 
   return;
   }
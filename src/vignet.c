@@ -42,40 +42,1215 @@
 #include	"fits/fitscat.h"
 #include	"vignet.h"
 
+#ifdef USE_THREADS
+#include	<pthread.h>
+#include	"threads.h"
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define	VIGNET_SIMD
+#include	<immintrin.h>
+#endif
+
+typedef void	(*vignet_convfunc)(const float *pixin, int instep, int nrow,
+			float *pixout, int outstep, const float *mask,
+			int mstride, const int *nmask, const int *start,
+			int nout, float *tile);
+
+static void	vignet_interpinit(void),
+		vignet_interpmask(double xs1, float step2, double dstepi,
+			int n2, int w1, int hmw, double *mask, double *dmask,
+			int *nmask, int *start),
+		vignet_conv(const float *pixin, int instep, int nrow,
+			float *pixout, int outstep, const float *mask,
+			int mstride, const int *nmask, const int *start,
+			int nout, float *tile);
+
+static int	vignet_convmask(double *mask, int *nmask, int n,
+			float *fmask),
+		vignet_resampleaxis(int w1, int w2, double d, float step2,
+			double *xs1, int *ixs2),
+		vignet_resample_batchrange(vignetbatchstruct *batch),
+		vignet_batchkeycmp(const void *key1, const void *key2);
+
+static void	vignet_batchyrange(double ys1, int ny2, int h1, float step2,
+			int hmh, int *iys1a, int *ny1),
+		vignet_pixelmask(double xs1, float step2, double dstepi,
+			int n2, int w1, int hmw, double *mask, int *nmask,
+			int *start);
+
+#ifdef USE_THREADS
+static void	*pthread_vignet_resample_batch(void *arg);
+#endif
+
+static void	vignet_growwork(vignetworkstruct *work, int nout, int nmaskel,
+			int npix12, int ncol, int gradflag);
+
+#ifdef VIGNET_SIMD
+static void	vignet_conv_sse2(const float *pixin, int instep, int nrow,
+			float *pixout, int outstep, const float *mask,
+			int mstride, const int *nmask, const int *start,
+			int nout, float *tile),
+		vignet_conv_avx2(const float *pixin, int instep, int nrow,
+			float *pixout, int outstep, const float *mask,
+			int mstride, const int *nmask, const int *start,
+			int nout, float *tile),
+		vignet_conv_avx512(const float *pixin, int instep, int nrow,
+			float *pixout, int outstep, const float *mask,
+			int mstride, const int *nmask, const int *start,
+			int nout, float *tile);
+
+static int	vignet_convtile(const float *pixin, int instep, int nrow,
+			int ntrow, const int *nmask, const int *start, int nout,
+			float *tile, int *cmin);
+
+/* Lane masks for partial stores: &vignet_lanemask[8-n] selects n lanes */
+static const int	vignet_lanemask[16] = {-1,-1,-1,-1,-1,-1,-1,-1,
+					0,0,0,0,0,0,0,0};
+#endif
+
+static vignet_convfunc	vignet_convsel = vignet_conv;	/* Pass kernel */
+
+
+static double	*vignet_interptab,	/* Tabulated interpolant */
+		*vignet_interpdtab;	/* Tabulated interpolant derivative */
+static int	vignet_ninterp;		/* Number of tabulated values */
+#ifdef USE_THREADS
+static pthread_once_t	vignet_interponce = PTHREAD_ONCE_INIT;
+#endif
+
+/* Linear overlap interpolant of vignet_resample_pixel() */
+#define	INTERPF_LINEAR_DOWN(x)	((fabs(x) > step2) ? 0.0 : step2 - fabs(x))
+
+/* Linear interpolation in the interpolant tables (0 outside) */
+#define	VIGNET_INTERPTAB(tab, t, f)	((t)<0 || (t)>=vignet_ninterp? 0.0 \
+			: (1.0-(f))*(tab)[t] + (f)*(tab)[(t)+1])
+
+/****** vignet_interpinit *****************************************************
+PROTO	void	vignet_interpinit(void)
+PURPOSE	Tabulate the interpolant used by vignet_resample() and its derivative,
+	and select the resampling pass kernel for the current CPU.
+INPUT	-.
+OUTPUT	-.
+NOTES	Called once, the tables are shared by all calls and threads. The
+	interpolant is set exactly to 0 at non-zero integer arguments, so that
+	integer shifts give exact copies.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+static void	vignet_interpinit(void)
+  {
+   double	x;
+   int		i, n, nh;
+
+  nh = (int)(INTERPFAC*VIGNET_INTERPRES);
+  n = 2*nh + 1;
+  QMALLOC(vignet_interptab, double, n+1);
+  QMALLOC(vignet_interpdtab, double, n+1);
+  for (i=0; i<n; i++)
+    {
+    x = (double)(i-nh)/VIGNET_INTERPRES;
+    vignet_interptab[i] = ((i-nh)%VIGNET_INTERPRES || i==nh)?
+					INTERPF(x) : 0.0;
+    vignet_interpdtab[i] = INTERPDF(x);
+    }
+/* Padding for the linear interpolation of the last element */
+  vignet_interptab[n] = vignet_interpdtab[n] = 0.0;
+  vignet_ninterp = n;
+
+#ifdef VIGNET_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    vignet_convsel = __builtin_cpu_supports("avx512f")?
+				vignet_conv_avx512 : vignet_conv_avx2;
+  else if (__builtin_cpu_supports("sse2"))
+    vignet_convsel = vignet_conv_sse2;
+#endif
+
+  return;
+  }
+
+
+/****** vignet_interpmask *****************************************************
+PROTO	void	vignet_interpmask(double xs1, float step2, double dstepi,
+		int n2, int w1, int hmw, double *mask, double *dmask,
+		int *nmask, int *start)
+PURPOSE	Compute the normalised interpolation masks of vignet_resample() along
+	one axis.
+INPUT	Input coordinate of the first output pixel,
+	output pixel scale,
+	inverse interpolant scale,
+	number of output pixels,
+	input raster size along the axis,
+	interpolant half-width (input pixels),
+	array of mask coefficients (output),
+	array of mask derivatives with respect to the shift (output, or NULL),
+	array of n2 mask sizes (output),
+	array of n2 input starting pixels (output).
+OUTPUT	-.
+NOTES	mask (and dmask) must hold n2*2*hmw elements; the masks are packed.
+	The interpolant is read from tables with VIGNET_INTERPRES steps per
+	unit and interpolated linearly. With dstepi = 1, all the taps of a mask
+	share the same table offset, and output pixels that fall right on an
+	input pixel reduce to a copy (unless derivatives are requested).
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+static void	vignet_interpmask(double xs1, float step2, double dstepi,
+		int n2, int w1, int hmw, double *mask, double *dmask,
+		int *nmask, int *start)
+  {
+   double	*maskt,*dmaskt, x1, x, dxm, pos, f, norm, dnorm;
+   int		i,j,n,t, ix,ix1, interpw;
+
+#ifdef USE_THREADS
+  pthread_once(&vignet_interponce, vignet_interpinit);
+#else
+  if (!vignet_interptab)
+    vignet_interpinit();
+#endif
+  interpw = 2*hmw;
+  x1 = xs1;
+  maskt = mask;
+  dmaskt = dmask;
+  for (j=0; j<n2; j++, x1+=step2)
+    {
+    ix = (ix1=(int)x1) - hmw;
+    if (dstepi==1.0 && !dmask && x1==(double)ix1)
+      {
+/*---- Integer shift: copy the input pixel */
+      start[j] = ix1;
+      nmask[j] = 1;
+      *(maskt++) = 1.0;
+      continue;
+      }
+    dxm = (ix1 - x1 - hmw)*dstepi;/* starting point in the interp. func */
+    if (ix < 0)
+      {
+      n = interpw+ix;
+      dxm -= (double)ix*dstepi;
+      ix = 0;
+      }
+    else
+      n = interpw;
+    if (n>(t=w1-ix))
+      n=t;
+    start[j] = ix;
+    nmask[j] = n;
+    norm = dnorm = 0.0;
+    if (dstepi==1.0)
+      {
+/*---- Taps are exactly VIGNET_INTERPRES table elements apart */
+      pos = (dxm+INTERPFAC)*VIGNET_INTERPRES;
+      f = pos - (t = (int)floor(pos));
+      for (i=n; i--; t+=VIGNET_INTERPRES)
+        {
+        norm += (*(maskt++) = VIGNET_INTERPTAB(vignet_interptab, t, f));
+        if (dmask)
+          dnorm += (*(dmaskt++) = VIGNET_INTERPTAB(vignet_interpdtab, t, f));
+        }
+      }
+    else
+      for (x=dxm, i=n; i--; x+=dstepi)
+        {
+        pos = (x+INTERPFAC)*VIGNET_INTERPRES;
+        f = pos - (t = (int)floor(pos));
+        norm += (*(maskt++) = VIGNET_INTERPTAB(vignet_interptab, t, f));
+        if (dmask)
+          dnorm += (*(dmaskt++) = VIGNET_INTERPTAB(vignet_interpdtab, t, f));
+        }
+    maskt -= n;
+    if (dmask)
+      {
+      dmaskt -= n;
+/*---- The interpolant argument decreases by dstepi per unit shift */
+      if (norm>0.0)
+        {
+        norm = 1.0/norm;
+        for (i=n; i--; maskt++, dmaskt++)
+          {
+          *maskt *= norm;
+          *dmaskt = -dstepi*norm*(*dmaskt - *maskt*dnorm);
+          }
+        }
+      else
+        for (i=n; i--;)
+          {
+          *(maskt++) *= dstepi;
+          *(dmaskt++) *= -dstepi*dstepi;
+          }
+      }
+    else
+      {
+      norm = norm>0.0? 1.0/norm : dstepi;
+      for (i=n; i--;)
+        *(maskt++) *= norm;
+      }
+    }
+
+  return;
+  }
+
+
+/****** vignet_pixelmask ******************************************************
+PROTO	void	vignet_pixelmask(double xs1, float step2, double dstepi,
+		int n2, int w1, int hmw, double *mask, int *nmask, int *start)
+PURPOSE	Compute the overlap interpolation masks of vignet_resample_pixel()
+	along one axis.
+INPUT	Input coordinate of the first output pixel,
+	output pixel scale,
+	inverse interpolant scale,
+	number of output pixels,
+	input raster size along the axis,
+	interpolant half-width (input pixels),
+	array of mask coefficients (output),
+	array of n2 mask sizes (output),
+	array of n2 input starting pixels (output).
+OUTPUT	-.
+NOTES	mask must hold n2*2*hmw elements; the masks are packed.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+static void	vignet_pixelmask(double xs1, float step2, double dstepi,
+			int n2, int w1, int hmw, double *mask, int *nmask,
+			int *start)
+  {
+   double	*maskt, x1, x, dxm;
+   int		i,j,n,t, ix,ix1, interpw;
+
+  interpw = 2*hmw;
+  x1 = xs1;
+  maskt = mask;
+  for (j=0; j<n2; j++, x1+=step2)
+    {
+    ix = (ix1=(int)x1) - hmw;
+    dxm = (ix1 - x1 - hmw)*dstepi;/* starting point in the interp. func */
+    if (ix < 0)
+      {
+      n = interpw+ix;
+      dxm -= (double)ix*dstepi;
+      ix = 0;
+      }
+    else
+      n = interpw;
+    if (n>(t=w1-ix))
+      n=t;
+    start[j] = ix;
+    nmask[j] = n;
+    for (x=dxm, i=n; i--; x+=dstepi)
+      *(maskt++) = INTERPF_LINEAR_DOWN(x);
+    }
+
+  return;
+  }
+
+
+/****** vignet_resampleaxis ***************************************************
+PROTO	int	vignet_resampleaxis(int w1, int w2, double d, float step2,
+		double *xs1, int *ixs2)
+PURPOSE	Compute the overlap of the input and output rasters of the
+	resampling functions along one axis.
+INPUT	Input raster size along the axis,
+	output raster size along the axis,
+	shift along the axis,
+	output pixel scale,
+	pointer to the input coordinate of the first overlapping output pixel
+	(output),
+	pointer to the index of the first overlapping output pixel (output).
+OUTPUT	Number of overlapping output pixels (0 if the rasters do not overlap).
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+static int	vignet_resampleaxis(int w1, int w2, double d, float step2,
+			double *xs1, int *ixs2)
+  {
+   double	x1;
+   int		dix2, n2;
+
+  x1 = (double)(w1/2) + d - (double)(w2/2)*step2;	/* Im1 start coord */
+  if ((int)x1 >= w1)
+    return 0;
+  *ixs2 = 0;			/* Int part of Im2 start coord */
+  if (x1<0.0)
+    {
+    dix2 = (int)(1-x1/step2);
+/*-- Simply leave here if the images do not overlap */
+    if (dix2 >= w2)
+      return 0;
+    *ixs2 = dix2;
+    x1 += dix2*step2;
+    }
+  n2 = (int)((w1-1-x1)/step2+1);	/* nb of interpolated Im2 pixels */
+  if (n2>w2-*ixs2)
+    n2 = w2-*ixs2;
+  *xs1 = x1;
+
+  return n2>0? n2 : 0;
+  }
+
+
+/****** vignet_convmask *******************************************************
+PROTO	int	vignet_convmask(double *mask, int *nmask, int n, float *fmask)
+PURPOSE	Convert packed interpolation masks to the single precision, fixed
+	stride layout used by the resampling pass kernels.
+INPUT	Array of packed mask coefficients,
+	array of n mask sizes,
+	number of masks,
+	array of converted masks (output).
+OUTPUT	Mask stride.
+NOTES	fmask must hold at least as many elements as mask.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+static int	vignet_convmask(double *mask, int *nmask, int n, float *fmask)
+  {
+   int		i,j, nmax;
+
+#ifdef USE_THREADS
+  pthread_once(&vignet_interponce, vignet_interpinit);
+#else
+  if (!vignet_interptab)
+    vignet_interpinit();
+#endif
+  nmax = 1;
+  for (j=0; j<n; j++)
+    if (nmask[j]>nmax)
+      nmax = nmask[j];
+  for (j=0; j<n; j++, fmask+=nmax)
+    {
+    for (i=0; i<nmask[j]; i++)
+      fmask[i] = (float)*(mask++);
+    for (; i<nmax; i++)
+      fmask[i] = 0.0f;
+    }
+
+  return nmax;
+  }
+
+
+/****** vignet_conv ***********************************************************
+PROTO	void	vignet_conv(const float *pixin, int instep, int nrow,
+		float *pixout, int outstep, const float *mask, int mstride,
+		const int *nmask, const int *start, int nout, float *tile)
+PURPOSE	Apply one (transposing) pass of the separable resampling:
+	pixout[k+j*outstep] = sum_i mask[j*mstride+i]*pixin[k*instep+start[j]+i]
+	for the nrow input rows k and the nout output pixels j.
+INPUT	Input raster,
+	input row step,
+	number of input rows,
+	output raster,
+	output step between output pixels,
+	array of mask coefficients (see vignet_convmask()),
+	mask stride,
+	array of nout mask sizes,
+	array of nout input starting pixels,
+	number of output pixels,
+	tile buffer for the SIMD versions (see vignet_initwork()).
+OUTPUT	-.
+NOTES	Sums are computed in single precision, with 4 interleaved partial
+	sums added pairwise. This is the portable version; vignet_interpinit()
+	may replace it with one of the SIMD versions below (same summation
+	order) through vignet_convsel.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+static void	vignet_conv(const float *pixin, int instep, int nrow,
+			float *pixout, int outstep, const float *mask,
+			int mstride, const int *nmask, const int *start,
+			int nout, float *tile)
+  {
+   const float	*pixint, *maskt;
+   float	*pixoutt, a0,a1,a2,a3;
+   int		i,j,k,n;
+
+  for (k=0; k<nrow; k++, pixin+=instep)
+    {
+    pixoutt = pixout+k;
+    for (j=0, maskt=mask; j<nout; j++, maskt+=mstride, pixoutt+=outstep)
+      {
+      pixint = pixin+start[j];
+      n = nmask[j];
+      a0 = a1 = a2 = a3 = 0.0f;
+      for (i=0; i+4<=n; i+=4)
+        {
+        a0 += maskt[i]*pixint[i];
+        a1 += maskt[i+1]*pixint[i+1];
+        a2 += maskt[i+2]*pixint[i+2];
+        a3 += maskt[i+3]*pixint[i+3];
+        }
+      if (i<n)
+        a0 += maskt[i]*pixint[i];
+      if (i+1<n)
+        a1 += maskt[i+1]*pixint[i+1];
+      if (i+2<n)
+        a2 += maskt[i+2]*pixint[i+2];
+      *pixoutt = (a0+a1)+(a2+a3);
+      }
+    }
+
+  return;
+  }
+
+
+#ifdef VIGNET_SIMD
+/****** vignet_convtile *******************************************************
+PROTO	int	vignet_convtile(const float *pixin, int instep, int nrow,
+		int ntrow, const int *nmask, const int *start, int nout,
+		float *tile, int *cmin)
+PURPOSE	Find the range of input columns read by a resampling pass, and copy
+	a tile of input rows transposed, for partial tiles.
+INPUT	Input raster,
+	input row step,
+	number of input rows to copy (0 = none),
+	number of rows in a tile,
+	array of nout mask sizes,
+	array of nout input starting pixels,
+	number of output pixels,
+	tile buffer,
+	pointer to the first column (output).
+OUTPUT	Number of columns.
+NOTES	Tile rows beyond nrow are set to 0.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+static int	vignet_convtile(const float *pixin, int instep, int nrow,
+			int ntrow, const int *nmask, const int *start, int nout,
+			float *tile, int *cmin)
+  {
+   int	c,j,r, cmax, ncol;
+
+  *cmin = start[0];
+  cmax = 0;
+  for (j=0; j<nout; j++)
+    {
+    if (start[j]<*cmin)
+      *cmin = start[j];
+    if (start[j]+nmask[j]>cmax)
+      cmax = start[j]+nmask[j];
+    }
+  ncol = cmax>*cmin? cmax-*cmin : 0;
+  if (nrow)
+    {
+    pixin += *cmin;
+    for (c=0; c<ncol; c++)
+      for (r=0; r<ntrow; r++)
+        tile[ntrow*c+r] = r<nrow? pixin[r*instep+c] : 0.0f;
+    }
+
+  return ncol;
+  }
+
+
+/****** vignet_conv_sse2 ******************************************************
+PROTO	void	vignet_conv_sse2(const float *pixin, int instep, int nrow,
+		float *pixout, int outstep, const float *mask, int mstride,
+		const int *nmask, const int *start, int nout, float *tile)
+PURPOSE	SSE2 version of vignet_conv().
+INPUT	See vignet_conv().
+OUTPUT	-.
+NOTES	Tiles of 4 input rows are transposed once (4x4 blocks), so that each
+	output pixel of the 4 rows is a vector sum of broadcast mask
+	coefficients times contiguous tile columns, stored as one contiguous
+	vector. Sums are computed in single precision, with 4 interleaved
+	partial sums added pairwise. The last, partial tile is padded with 0s,
+	so that the result for a given row does not depend on its position.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+__attribute__((target("sse2")))
+static void	vignet_conv_sse2(const float *pixin, int instep, int nrow,
+			float *pixout, int outstep, const float *mask,
+			int mstride, const int *nmask, const int *start,
+			int nout, float *tile)
+  {
+   const float	*pixint, *maskt;
+   float	*tilet, buf[4];
+   __m128	r0,r1,r2,r3, a0,a1,a2,a3;
+   int		c,i,j,k,n, cmin,ncol, nr;
+
+  for (k=0; k<nrow; k+=4, pixin+=4*instep)
+    {
+/*-- Transpose the tile */
+    if ((nr=nrow-k) < 4)
+      ncol = vignet_convtile(pixin, instep, nr, 4, nmask, start, nout, tile,
+		&cmin);
+    else
+      {
+      ncol = vignet_convtile(pixin, instep, 0, 4, nmask, start, nout, tile,
+		&cmin);
+      pixint = pixin+cmin;
+      for (c=0; c+4<=ncol; c+=4)
+        {
+        r0 = _mm_loadu_ps(pixint+c);
+        r1 = _mm_loadu_ps(pixint+instep+c);
+        r2 = _mm_loadu_ps(pixint+2*instep+c);
+        r3 = _mm_loadu_ps(pixint+3*instep+c);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(tile+4*c, r0);
+        _mm_storeu_ps(tile+4*c+4, r1);
+        _mm_storeu_ps(tile+4*c+8, r2);
+        _mm_storeu_ps(tile+4*c+12, r3);
+        }
+      for (; c<ncol; c++)
+        {
+        tile[4*c] = pixint[c];
+        tile[4*c+1] = pixint[instep+c];
+        tile[4*c+2] = pixint[2*instep+c];
+        tile[4*c+3] = pixint[3*instep+c];
+        }
+      }
+/*-- Convolve */
+    for (j=0, maskt=mask; j<nout; j++, maskt+=mstride)
+      {
+      tilet = tile+4*(start[j]-cmin);
+      n = nmask[j];
+      a0 = a1 = a2 = a3 = _mm_setzero_ps();
+      for (i=0; i+4<=n; i+=4, tilet+=16)
+        {
+        a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_set1_ps(maskt[i]),
+		_mm_loadu_ps(tilet)));
+        a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_set1_ps(maskt[i+1]),
+		_mm_loadu_ps(tilet+4)));
+        a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_set1_ps(maskt[i+2]),
+		_mm_loadu_ps(tilet+8)));
+        a3 = _mm_add_ps(a3, _mm_mul_ps(_mm_set1_ps(maskt[i+3]),
+		_mm_loadu_ps(tilet+12)));
+        }
+      if (i<n)
+        a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_set1_ps(maskt[i]),
+		_mm_loadu_ps(tilet)));
+      if (i+1<n)
+        a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_set1_ps(maskt[i+1]),
+		_mm_loadu_ps(tilet+4)));
+      if (i+2<n)
+        a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_set1_ps(maskt[i+2]),
+		_mm_loadu_ps(tilet+8)));
+      a0 = _mm_add_ps(_mm_add_ps(a0, a1), _mm_add_ps(a2, a3));
+      if (nr<4)
+        {
+        _mm_storeu_ps(buf, a0);
+        memcpy(pixout+k+j*outstep, buf, (size_t)nr*sizeof(float));
+        }
+      else
+        _mm_storeu_ps(pixout+k+j*outstep, a0);
+      }
+    }
+
+  return;
+  }
+
+
+/****** vignet_transpose8_avx *************************************************
+PROTO	void	vignet_transpose8_avx(const float *pix, int step, float *tile,
+		int tstep)
+PURPOSE	Transpose an 8x8 block of single precision values.
+INPUT	Pointer to the first input element,
+	input row step,
+	pointer to the first output element,
+	output row step.
+OUTPUT	-.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+__attribute__((target("avx2,fma")))
+static inline void	vignet_transpose8_avx(const float *pix, int step,
+				float *tile, int tstep)
+  {
+   __m256	r0,r1,r2,r3,r4,r5,r6,r7, t0,t1,t2,t3,t4,t5,t6,t7;
+
+  r0 = _mm256_loadu_ps(pix);
+  r1 = _mm256_loadu_ps(pix+step);
+  r2 = _mm256_loadu_ps(pix+2*step);
+  r3 = _mm256_loadu_ps(pix+3*step);
+  r4 = _mm256_loadu_ps(pix+4*step);
+  r5 = _mm256_loadu_ps(pix+5*step);
+  r6 = _mm256_loadu_ps(pix+6*step);
+  r7 = _mm256_loadu_ps(pix+7*step);
+  t0 = _mm256_unpacklo_ps(r0, r1);
+  t1 = _mm256_unpackhi_ps(r0, r1);
+  t2 = _mm256_unpacklo_ps(r2, r3);
+  t3 = _mm256_unpackhi_ps(r2, r3);
+  t4 = _mm256_unpacklo_ps(r4, r5);
+  t5 = _mm256_unpackhi_ps(r4, r5);
+  t6 = _mm256_unpacklo_ps(r6, r7);
+  t7 = _mm256_unpackhi_ps(r6, r7);
+  r0 = _mm256_shuffle_ps(t0, t2, 0x44);
+  r1 = _mm256_shuffle_ps(t0, t2, 0xEE);
+  r2 = _mm256_shuffle_ps(t1, t3, 0x44);
+  r3 = _mm256_shuffle_ps(t1, t3, 0xEE);
+  r4 = _mm256_shuffle_ps(t4, t6, 0x44);
+  r5 = _mm256_shuffle_ps(t4, t6, 0xEE);
+  r6 = _mm256_shuffle_ps(t5, t7, 0x44);
+  r7 = _mm256_shuffle_ps(t5, t7, 0xEE);
+  _mm256_storeu_ps(tile, _mm256_permute2f128_ps(r0, r4, 0x20));
+  _mm256_storeu_ps(tile+tstep, _mm256_permute2f128_ps(r1, r5, 0x20));
+  _mm256_storeu_ps(tile+2*tstep, _mm256_permute2f128_ps(r2, r6, 0x20));
+  _mm256_storeu_ps(tile+3*tstep, _mm256_permute2f128_ps(r3, r7, 0x20));
+  _mm256_storeu_ps(tile+4*tstep, _mm256_permute2f128_ps(r0, r4, 0x31));
+  _mm256_storeu_ps(tile+5*tstep, _mm256_permute2f128_ps(r1, r5, 0x31));
+  _mm256_storeu_ps(tile+6*tstep, _mm256_permute2f128_ps(r2, r6, 0x31));
+  _mm256_storeu_ps(tile+7*tstep, _mm256_permute2f128_ps(r3, r7, 0x31));
+
+  return;
+  }
+
+
+/****** vignet_conv_avx2 ******************************************************
+PROTO	void	vignet_conv_avx2(const float *pixin, int instep, int nrow,
+		float *pixout, int outstep, const float *mask, int mstride,
+		const int *nmask, const int *start, int nout, float *tile)
+PURPOSE	AVX2 version of vignet_conv().
+INPUT	See vignet_conv().
+OUTPUT	-.
+NOTES	Same scheme as vignet_conv_sse2(), with tiles of 8 rows and FMAs.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+__attribute__((target("avx2,fma")))
+static void	vignet_conv_avx2(const float *pixin, int instep, int nrow,
+			float *pixout, int outstep, const float *mask,
+			int mstride, const int *nmask, const int *start,
+			int nout, float *tile)
+  {
+   const float	*pixint, *maskt;
+   float	*tilet;
+   __m256	a0,a1,a2,a3;
+   __m256i	smask;
+   int		c,i,j,k,r,n, cmin,ncol, nr;
+
+  for (k=0; k<nrow; k+=8, pixin+=8*instep)
+    {
+/*-- Transpose the tile */
+    if ((nr=nrow-k) < 8)
+      {
+      ncol = vignet_convtile(pixin, instep, nr, 8, nmask, start, nout, tile,
+		&cmin);
+      smask = _mm256_loadu_si256((const __m256i *)(vignet_lanemask+8-nr));
+      }
+    else
+      {
+      ncol = vignet_convtile(pixin, instep, 0, 8, nmask, start, nout, tile,
+		&cmin);
+      smask = _mm256_set1_epi32(-1);
+      pixint = pixin+cmin;
+      for (c=0; c+8<=ncol; c+=8)
+        vignet_transpose8_avx(pixint+c, instep, tile+8*c, 8);
+      for (; c<ncol; c++)
+        for (r=0; r<8; r++)
+          tile[8*c+r] = pixint[r*instep+c];
+      }
+/*-- Convolve */
+    for (j=0, maskt=mask; j<nout; j++, maskt+=mstride)
+      {
+      tilet = tile+8*(start[j]-cmin);
+      n = nmask[j];
+      a0 = a1 = a2 = a3 = _mm256_setzero_ps();
+      for (i=0; i+4<=n; i+=4, tilet+=32)
+        {
+        a0 = _mm256_fmadd_ps(_mm256_broadcast_ss(maskt+i),
+		_mm256_loadu_ps(tilet), a0);
+        a1 = _mm256_fmadd_ps(_mm256_broadcast_ss(maskt+i+1),
+		_mm256_loadu_ps(tilet+8), a1);
+        a2 = _mm256_fmadd_ps(_mm256_broadcast_ss(maskt+i+2),
+		_mm256_loadu_ps(tilet+16), a2);
+        a3 = _mm256_fmadd_ps(_mm256_broadcast_ss(maskt+i+3),
+		_mm256_loadu_ps(tilet+24), a3);
+        }
+      if (i<n)
+        a0 = _mm256_fmadd_ps(_mm256_broadcast_ss(maskt+i),
+		_mm256_loadu_ps(tilet), a0);
+      if (i+1<n)
+        a1 = _mm256_fmadd_ps(_mm256_broadcast_ss(maskt+i+1),
+		_mm256_loadu_ps(tilet+8), a1);
+      if (i+2<n)
+        a2 = _mm256_fmadd_ps(_mm256_broadcast_ss(maskt+i+2),
+		_mm256_loadu_ps(tilet+16), a2);
+      a0 = _mm256_add_ps(_mm256_add_ps(a0, a1), _mm256_add_ps(a2, a3));
+      if (nr<8)
+        _mm256_maskstore_ps(pixout+k+j*outstep, smask, a0);
+      else
+        _mm256_storeu_ps(pixout+k+j*outstep, a0);
+      }
+    }
+
+  return;
+  }
+
+
+/****** vignet_conv_avx512 ****************************************************
+PROTO	void	vignet_conv_avx512(const float *pixin, int instep, int nrow,
+		float *pixout, int outstep, const float *mask, int mstride,
+		const int *nmask, const int *start, int nout, float *tile)
+PURPOSE	AVX-512 version of vignet_conv().
+INPUT	See vignet_conv().
+OUTPUT	-.
+NOTES	Same scheme as vignet_conv_sse2(), with tiles of 16 rows (transposed
+	as pairs of 8x8 blocks) and FMAs.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+__attribute__((target("avx512f,avx2,fma")))
+static void	vignet_conv_avx512(const float *pixin, int instep, int nrow,
+			float *pixout, int outstep, const float *mask,
+			int mstride, const int *nmask, const int *start,
+			int nout, float *tile)
+  {
+   const float	*pixint, *maskt;
+   float	*tilet;
+   __m512	a0,a1,a2,a3;
+   __mmask16	smask;
+   int		c,i,j,k,r,n, cmin,ncol, nr;
+
+  for (k=0; k<nrow; k+=16, pixin+=16*instep)
+    {
+/*-- Transpose the tile */
+    if ((nr=nrow-k) < 16)
+      {
+      ncol = vignet_convtile(pixin, instep, nr, 16, nmask, start, nout, tile,
+		&cmin);
+      smask = (__mmask16)((1<<nr)-1);
+      }
+    else
+      {
+      ncol = vignet_convtile(pixin, instep, 0, 16, nmask, start, nout, tile,
+		&cmin);
+      smask = (__mmask16)0xFFFF;
+      pixint = pixin+cmin;
+      for (c=0; c+8<=ncol; c+=8)
+        {
+        vignet_transpose8_avx(pixint+c, instep, tile+16*c, 16);
+        vignet_transpose8_avx(pixint+8*instep+c, instep, tile+16*c+8, 16);
+        }
+      for (; c<ncol; c++)
+        for (r=0; r<16; r++)
+          tile[16*c+r] = pixint[r*instep+c];
+      }
+/*-- Convolve */
+    for (j=0, maskt=mask; j<nout; j++, maskt+=mstride)
+      {
+      tilet = tile+16*(start[j]-cmin);
+      n = nmask[j];
+      a0 = a1 = a2 = a3 = _mm512_setzero_ps();
+      for (i=0; i+4<=n; i+=4, tilet+=64)
+        {
+        a0 = _mm512_fmadd_ps(_mm512_set1_ps(maskt[i]),
+		_mm512_loadu_ps(tilet), a0);
+        a1 = _mm512_fmadd_ps(_mm512_set1_ps(maskt[i+1]),
+		_mm512_loadu_ps(tilet+16), a1);
+        a2 = _mm512_fmadd_ps(_mm512_set1_ps(maskt[i+2]),
+		_mm512_loadu_ps(tilet+32), a2);
+        a3 = _mm512_fmadd_ps(_mm512_set1_ps(maskt[i+3]),
+		_mm512_loadu_ps(tilet+48), a3);
+        }
+      if (i<n)
+        a0 = _mm512_fmadd_ps(_mm512_set1_ps(maskt[i]),
+		_mm512_loadu_ps(tilet), a0);
+      if (i+1<n)
+        a1 = _mm512_fmadd_ps(_mm512_set1_ps(maskt[i+1]),
+		_mm512_loadu_ps(tilet+16), a1);
+      if (i+2<n)
+        a2 = _mm512_fmadd_ps(_mm512_set1_ps(maskt[i+2]),
+		_mm512_loadu_ps(tilet+32), a2);
+      _mm512_mask_storeu_ps(pixout+k+j*outstep, smask,
+	_mm512_add_ps(_mm512_add_ps(a0, a1), _mm512_add_ps(a2, a3)));
+      }
+    }
+
+  return;
+  }
+#endif
+
+
+/****** vignet_initwork *******************************************************
+PROTO	vignetworkstruct *vignet_initwork(int w1, int h1, int w2, int h2,
+		float stepi)
+PURPOSE	Create a workspace for the vignet_resample*_work() functions.
+INPUT	Maximum input raster width,
+	maximum input raster height,
+	maximum output raster width,
+	maximum output raster height,
+	maximum interpolant scale (0 = 1).
+OUTPUT	Pointer to the new workspace.
+NOTES	A workspace must not be shared by concurrent calls: create one per
+	thread. Buffers are sized for the given dimensions (which may be 0),
+	and grown by the resampling functions if needed.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+vignetworkstruct	*vignet_initwork(int w1, int h1, int w2, int h2,
+				float stepi)
+  {
+   vignetworkstruct	*work;
+   int			nout, interp;
+
+  QCALLOC(work, vignetworkstruct, 1);
+  if (stepi <= 0.0)
+    stepi = 1.0;
+  nout = w2>h2? w2 : h2;
+  interp = 2*((int)((INTERPW/2)*stepi) + 2);
+  vignet_growwork(work, nout, nout*interp, w2*h1, w1>h1? w1:h1, 0);
+
+  return work;
+  }
+
+
+/****** vignet_endwork ********************************************************
+PROTO	void	vignet_endwork(vignetworkstruct *work)
+PURPOSE	Free a workspace created by vignet_initwork().
+INPUT	Pointer to the workspace.
+OUTPUT	-.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+void	vignet_endwork(vignetworkstruct *work)
+  {
+  free(work->mask);
+  free(work->dmask);
+  free(work->fmask);
+  free(work->fdmask);
+  free(work->nmask);
+  free(work->start);
+  free(work->fymask);
+  free(work->nymask);
+  free(work->ystart);
+  free(work->pix12);
+  free(work->pix12x);
+  free(work->tile);
+  free(work);
+
+  return;
+  }
+
+
+/****** vignet_growwork *******************************************************
+PROTO	void	vignet_growwork(vignetworkstruct *work, int nout, int nmaskel,
+		int npix12, int ncol, int gradflag)
+PURPOSE	Make sure the buffers of a workspace are large enough.
+INPUT	Pointer to the workspace,
+	number of output pixels along one axis,
+	number of mask elements,
+	number of intermediary frame-buffer pixels,
+	maximum number of input pixels along one axis,
+	derivative buffers flag.
+OUTPUT	-.
+NOTES	Buffers only grow, so that after the first calls resampling does not
+	allocate memory anymore.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+static void	vignet_growwork(vignetworkstruct *work, int nout, int nmaskel,
+			int npix12, int ncol, int gradflag)
+  {
+  if (nout<1)
+    nout = 1;
+  if (nmaskel<1)
+    nmaskel = 1;
+  if (npix12<1)
+    npix12 = 1;
+  if (nout>work->nout)
+    {
+    free(work->nmask);
+    free(work->start);
+    free(work->nymask);
+    free(work->ystart);
+    QMALLOC(work->nmask, int, nout);
+    QMALLOC(work->start, int, nout);
+    QMALLOC(work->nymask, int, nout);
+    QMALLOC(work->ystart, int, nout);
+    work->nout = nout;
+    }
+  if (nmaskel>work->nmaskel)
+    {
+    free(work->mask);
+    free(work->fmask);
+    free(work->dmask);
+    free(work->fdmask);
+    free(work->fymask);
+    QMALLOC(work->mask, double, nmaskel);
+    QMALLOC(work->fmask, float, nmaskel);
+    QMALLOC(work->fymask, float, nmaskel);
+    work->dmask = NULL;
+    work->fdmask = NULL;
+    work->nmaskel = nmaskel;
+    work->gradflag = 0;
+    }
+  if (npix12>work->npix12)
+    {
+    free(work->pix12);
+    free(work->pix12x);
+    QMALLOC(work->pix12, float, npix12);
+    work->pix12x = NULL;
+    work->npix12 = npix12;
+    work->gradflag = 0;
+    }
+  if (gradflag && !work->gradflag)
+    {
+    free(work->dmask);
+    free(work->fdmask);
+    free(work->pix12x);
+    QMALLOC(work->dmask, double, work->nmaskel);
+    QMALLOC(work->fdmask, float, work->nmaskel);
+    QMALLOC(work->pix12x, float, work->npix12);
+    work->gradflag = 1;
+    }
+/* Tiles hold up to 16 rows of ncol pixels */
+  if (16*(ncol+1)>work->ntile)
+    {
+    free(work->tile);
+    work->ntile = 16*(ncol+1);
+    QMALLOC(work->tile, float, work->ntile);
+    }
+
+  return;
+  }
+
+
+/****** vignet_resample ******************************************************
+PROTO	int	vignet_resample(float *pix1, int w1, int h1,
+		float *pix2, int w2, int h2, double dx, double dy, float step2,
+		float stepi)
+PURPOSE	Scale and shift a small image through sinc interpolation, with
+	adjustable spatial wavelength cut-off. Image parts which lie outside
+	boundaries are set to 0.
+
+INPUT	Input raster,
+	input raster width,
+	input raster height,
+	output raster,
+	output raster width,
+	output raster height,
+	shift in x,
+	shift in y,
+	output pixel scale.	
+OUTPUT	RETURN_ERROR if the images do not overlap, RETURN_OK otherwise.
+NOTES	Wrapper to vignet_resample_work() with a temporary workspace. If pix2
+	is NULL, the output raster of the previous call is reused, which makes
+	this function non-reentrant: threads should call
+	vignet_resample_work() with their own workspace.
+AUTHOR	E. Bertin (IAP)
+VERSION	18/10/2026
+ ***/
+int	vignet_resample(float *pix1, int w1, int h1,
+		float *pix2, int w2, int h2, double dx, double dy, float step2,
+		float stepi)
+  {
+   static float		*statpix2;
+   vignetworkstruct	*work;
+   int			status;
+
+  work = vignet_initwork(w1,h1, w2,h2, stepi);
+  work->pix2 = statpix2;
+  status = vignet_resample_work(work, pix1,w1,h1, pix2,w2,h2, dx,dy, step2,
+	stepi);
+  statpix2 = work->pix2;
+  vignet_endwork(work);
+
+  return status;
+  }
+
+
+/****** vignet_resample_work *************************************************
+PROTO	int	vignet_resample_work(vignetworkstruct *work,
+		float *pix1, int w1, int h1, float *pix2, int w2, int h2,
+		double dx, double dy, float step2, float stepi)
+PURPOSE	Scale and shift a small image through sinc interpolation, with
+	adjustable spatial wavelength cut-off, using a workspace. Image parts
+	which lie outside boundaries are set to 0.
+INPUT	Pointer to the workspace (see vignet_initwork()),
+	input raster,
+	input raster width,
+	input raster height,
+	output raster (or NULL to reuse the last one of the workspace),
+	output raster width,
+	output raster height,
+	shift in x,
+	shift in y,
+	output pixel scale,
+	interpolant scale.
+OUTPUT	RETURN_ERROR if the images do not overlap, RETURN_OK otherwise.
+NOTES	The interpolant is tabulated (see vignet_interpmask()). Both passes
+	run through the vignet_conv() kernel selected for the current CPU.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+int	vignet_resample_work(vignetworkstruct *work,
+		float *pix1, int w1, int h1, float *pix2, int w2, int h2,
+		double dx, double dy, float step2, float stepi)
+  {
+   double	mx1,mx2,my1,my2, xs1,ys1, dstepi;
+   int		ixs2,iys2, ix2,iy2, dix2,diy2, nx2,ny2, iys1a, ny1, hmw,hmh,
+		interpw, interph, mstride;
+
+  if (stepi <= 0.0)
+    stepi = 1.0;
+  dstepi = 1.0/stepi;
+  mx1 = (double)(w1/2);		/* Im1 center x-coord*/
+  mx2 = (double)(w2/2);		/* Im2 center x-coord*/
+  xs1 = mx1 + dx - mx2*step2;	/* Im1 start x-coord */
+
+  if ((int)xs1 >= w1)
+    return RETURN_ERROR;
+  ixs2 = 0;			/* Int part of Im2 start x-coord */
+  if (xs1<0.0)
+    {
+    dix2 = (int)(1-xs1/step2);
+/*-- Simply leave here if the images do not overlap in x */
+    if (dix2 >= w2)
+      return RETURN_ERROR;
+    ixs2 += dix2;
+    xs1 += dix2*step2;
+    }
+  nx2 = (int)((w1-1-xs1)/step2+1);/* nb of interpolated Im2 pixels along x */
+  if (nx2>(ix2=w2-ixs2))
+    nx2 = ix2;
+  if (nx2<=0)
+    return RETURN_ERROR;
+  my1 = (double)(h1/2);		/* Im1 center y-coord */
+  my2 = (double)(h2/2);		/* Im2 center y-coord */
+  ys1 = my1 + dy - my2*step2;	/* Im1 start y-coord */
+  if ((int)ys1 >= h1)
+    return RETURN_ERROR;
+  iys2 = 0;			/* Int part of Im2 start y-coord */
+  if (ys1<0.0)
+    {
+    diy2 = (int)(1-ys1/step2);
+/*-- Simply leave here if the images do not overlap in y */
+    if (diy2 >= h2)
+      return RETURN_ERROR;
+    iys2 += diy2;
+    ys1 += diy2*step2;
+    }
+  ny2 = (int)((h1-1-ys1)/step2+1);/* nb of interpolated Im2 pixels along y */
+  if (ny2>(iy2=h2-iys2))
+    ny2 = iy2;
+  if (ny2<=0)
+    return RETURN_ERROR;
 
-/****** vignet_resample ******************************************************
-PROTO	int	vignet_resample(float *pix1, int w1, int h1,
-		float *pix2, int w2, int h2, double dx, double dy, float step2,
-		float stepi)
-PURPOSE	Scale and shift a small image through sinc interpolation, with
-	adjustable spatial wavelength cut-off. Image parts which lie outside
-	boundaries are set to 0.
+/* Set the yrange for the x-resampling with some margin for interpolation */
+  iys1a = (int)ys1;		/* Int part of Im1 start y-coord with margin */
+  hmh = (int)((INTERPW/2)/dstepi) + 2;	/* Interpolant start */
+  interph = 2*hmh;
+  hmw = (int)((INTERPW/2)/dstepi) + 2;
+  interpw =  2*hmw;
+  if (iys1a<0 || ((iys1a -= hmh)< 0))
+    iys1a = 0;
+  ny1 = (int)(ys1+ny2*step2)+interpw-hmh;	/* Interpolated Im1 y size */
+  if (ny1>h1)					/* with margin */
+    ny1 = h1;
+/* Express everything relative to the effective Im1 start (with margin) */
+  ny1 -= iys1a;
+  ys1 -= (double)iys1a;
+
+  vignet_growwork(work, nx2>ny2? nx2:ny2,
+	nx2*interpw>ny2*interph? nx2*interpw : ny2*interph, nx2*ny1,
+	w1>ny1? w1:ny1, 0);
+
+/* Compute the local interpolant and data starting points in x */
+  vignet_interpmask(xs1, step2, dstepi, nx2, w1, hmw, work->mask, NULL,
+	work->nmask, work->start);
+  mstride = vignet_convmask(work->mask, work->nmask, nx2, work->fmask);
+
+/* Make the interpolation in x (this includes transposition) */
+  vignet_convsel(pix1+iys1a*w1, w1, ny1, work->pix12, ny1, work->fmask,
+	mstride, work->nmask, work->start, nx2, work->tile);
+
+/* Compute the local interpolant and data starting points in y */
+  vignet_interpmask(ys1, step2, dstepi, ny2, ny1, hmh, work->mask, NULL,
+	work->nmask, work->start);
+  mstride = vignet_convmask(work->mask, work->nmask, ny2, work->fmask);
+
+/* Initialize destination buffer to zero if pix2 != NULL */
+  if (!pix2)
+    pix2 = work->pix2;
+  else
+    {
+    memset(pix2, 0, (size_t)(w2*h2)*sizeof(float));
+    work->pix2 = pix2;
+    }
+
+/* Make the interpolation in y  and transpose once again */
+  vignet_convsel(work->pix12, ny1, nx2, pix2+ixs2+iys2*w2, w2, work->fmask,
+	mstride, work->nmask, work->start, ny2, work->tile);
+
+  return RETURN_OK;
+  }
 
+
+/****** vignet_resample_grad *************************************************
+PROTO	int	vignet_resample_grad(float *pix1, int w1, int h1,
+		float *pix2, float *pix2x, float *pix2y, int w2, int h2,
+		double dx, double dy, float step2, float stepi)
+PURPOSE	Scale and shift a small image through sinc interpolation like
+	vignet_resample(), and compute the derivatives of the result with
+	respect to the shifts.
 INPUT	Input raster,
 	input raster width,
 	input raster height,
 	output raster,
+	output raster of derivatives with respect to dx,
+	output raster of derivatives with respect to dy,
 	output raster width,
 	output raster height,
 	shift in x,
 	shift in y,
-	output pixel scale.	
+	output pixel scale,
+	interpolant scale.
 OUTPUT	RETURN_ERROR if the images do not overlap, RETURN_OK otherwise.
-NOTES	-.
+NOTES	Wrapper to vignet_resample_grad_work() with a temporary workspace.
 AUTHOR	E. Bertin (IAP)
-VERSION	13/09/2010
+VERSION	18/10/2026
  ***/
-int	vignet_resample(float *pix1, int w1, int h1,
-		float *pix2, int w2, int h2, double dx, double dy, float step2,
-		float stepi)
+int	vignet_resample_grad(float *pix1, int w1, int h1,
+		float *pix2, float *pix2x, float *pix2y, int w2, int h2,
+		double dx, double dy, float step2, float stepi)
+  {
+   vignetworkstruct	*work;
+   int			status;
+
+  work = vignet_initwork(w1,h1, w2,h2, stepi);
+  status = vignet_resample_grad_work(work, pix1,w1,h1, pix2,pix2x,pix2y,
+	w2,h2, dx,dy, step2, stepi);
+  vignet_endwork(work);
+
+  return status;
+  }
+
+
+/****** vignet_resample_grad_work ********************************************
+PROTO	int	vignet_resample_grad_work(vignetworkstruct *work,
+		float *pix1, int w1, int h1,
+		float *pix2, float *pix2x, float *pix2y, int w2, int h2,
+		double dx, double dy, float step2, float stepi)
+PURPOSE	Scale and shift a small image through sinc interpolation like
+	vignet_resample_work(), and compute the derivatives of the result with
+	respect to the shifts.
+INPUT	Pointer to the workspace (see vignet_initwork()),
+	input raster,
+	input raster width,
+	input raster height,
+	output raster,
+	output raster of derivatives with respect to dx,
+	output raster of derivatives with respect to dy,
+	output raster width,
+	output raster height,
+	shift in x,
+	shift in y,
+	output pixel scale,
+	interpolant scale.
+OUTPUT	RETURN_ERROR if the images do not overlap, RETURN_OK otherwise.
+NOTES	pix2 is identical to the output of vignet_resample(). Derivatives are
+	computed analytically from those of the (normalised) interpolant,
+	with the same vignet_conv() kernel as the resampling itself.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+int	vignet_resample_grad_work(vignetworkstruct *work,
+		float *pix1, int w1, int h1,
+		float *pix2, float *pix2x, float *pix2y, int w2, int h2,
+		double dx, double dy, float step2, float stepi)
   {
-   static float	*statpix2;
-   double	*mask,*maskt, mx1,mx2,my1,my2, xs1,ys1, x1,y1, x,y, dxm,dym,
-		val, dstepi, norm;
-   float	*pix12, *pixin,*pixin0, *pixout,*pixout0;
-   int		i,j,k,n,t, *start,*startt, *nmask,*nmaskt,
-		ixs2,iys2, ix2,iy2, dix2,diy2, nx2,ny2, iys1a, ny1, hmw,hmh,
-		ix,iy, ix1,iy1, interpw, interph;
+   double	mx1,mx2,my1,my2, xs1,ys1, dstepi;
+   int		ixs2,iys2, ix2,iy2, dix2,diy2, nx2,ny2, iys1a, ny1, hmw,hmh,
+		interpw, interph, mstride, off2;
 
   if (stepi <= 0.0)
     stepi = 1.0;
@@ -137,133 +1312,46 @@ int	vignet_resample(float *pix1, int w1, int h1,
   ny1 -= iys1a;
   ys1 -= (double)iys1a;
 
-/* Allocate interpolant stuff for the x direction */
-  QMALLOC(mask, double, nx2*interpw);	/* Interpolation masks */
-  QMALLOC(nmask, int, nx2);		/* Interpolation mask sizes */
-  QMALLOC(start, int, nx2);		/* Int part of Im1 conv starts */
-/* Compute the local interpolant and data starting points in x */
-  x1 = xs1;
-  maskt = mask;
-  nmaskt = nmask;
-  startt = start;
-  for (j=nx2; j--; x1+=step2)
-    {
-    ix = (ix1=(int)x1) - hmw;
-    dxm = (ix1 - x1 - hmw)*dstepi;/* starting point in the interp. func */
-    if (ix < 0)
-      {
-      n = interpw+ix;
-      dxm -= (double)ix*dstepi;
-      ix = 0;
-      }
-    else
-      n = interpw;
-    if (n>(t=w1-ix))
-      n=t;
-    *(startt++) = ix;
-    *(nmaskt++) = n;
-    norm = 0.0;
-    for (x=dxm, i=n; i--; x+=dstepi)
-      norm +=( *(maskt++) = INTERPF(x));
-    norm = norm>0.0? 1.0/norm : dstepi;
-    maskt -= n;
-    for (i=n; i--;)
-      *(maskt++) *= norm;
-    }
+  vignet_growwork(work, nx2>ny2? nx2:ny2,
+	nx2*interpw>ny2*interph? nx2*interpw : ny2*interph, nx2*ny1,
+	w1>ny1? w1:ny1, 1);
 
-  QCALLOC(pix12, float, nx2*ny1);	/* Intermediary frame-buffer */
+/* Compute the local interpolant, its derivative and data starting points */
+  vignet_interpmask(xs1, step2, dstepi, nx2, w1, hmw, work->mask, work->dmask,
+	work->nmask, work->start);
+  mstride = vignet_convmask(work->mask, work->nmask, nx2, work->fmask);
+  vignet_convmask(work->dmask, work->nmask, nx2, work->fdmask);
 
 /* Make the interpolation in x (this includes transposition) */
-  pixin0 = pix1+iys1a*w1;
-  pixout0 = pix12;
-  for (k=ny1; k--; pixin0+=w1, pixout0++)
-    {
-    maskt = mask;
-    nmaskt = nmask;
-    startt = start;
-    pixout = pixout0;
-    for (j=nx2; j--; pixout+=ny1)
-      {
-      pixin = pixin0+*(startt++);
-      val = 0.0; 
-      for (i=*(nmaskt++); i--;)
-        val += *(maskt++)*(double)*(pixin++);
-      *pixout = (float)val;
-      }
-    }
-
-/* Reallocate interpolant stuff for the y direction */
-  QREALLOC(mask, double, ny2*interph);	/* Interpolation masks */
-  QREALLOC(nmask, int, ny2);		/* Interpolation mask sizes */
-  QREALLOC(start, int, ny2);		/* Int part of Im1 conv starts */
+  vignet_convsel(pix1+iys1a*w1, w1, ny1, work->pix12, ny1, work->fmask,
+	mstride, work->nmask, work->start, nx2, work->tile);
+  vignet_convsel(pix1+iys1a*w1, w1, ny1, work->pix12x, ny1, work->fdmask,
+	mstride, work->nmask, work->start, nx2, work->tile);
 
-/* Compute the local interpolant and data starting points in y */
-  y1 = ys1;
-  maskt = mask;
-  nmaskt = nmask;
-  startt = start;
-  for (j=ny2; j--; y1+=step2)
-    {
-    iy = (iy1=(int)y1) - hmh;
-    dym = (iy1 - y1 - hmh)*dstepi;/* starting point in the interp. func */
-    if (iy < 0)
-      {
-      n = interph+iy;
-      dym -= (double)iy*dstepi;
-      iy = 0;
-      }
-    else
-      n = interph;
-    if (n>(t=ny1-iy))
-      n=t;
-    *(startt++) = iy;
-    *(nmaskt++) = n;
-    norm = 0.0;
-    for (y=dym, i=n; i--; y+=dstepi)
-      norm += (*(maskt++) = INTERPF(y));
-    norm = norm>0.0? 1.0/norm : dstepi;
-    maskt -= n;
-    for (i=n; i--;)
-      *(maskt++) *= norm;
-    }
+/* Compute the local interpolant, its derivative and data starting points */
+  vignet_interpmask(ys1, step2, dstepi, ny2, ny1, hmh, work->mask, work->dmask,
+	work->nmask, work->start);
+  mstride = vignet_convmask(work->mask, work->nmask, ny2, work->fmask);
+  vignet_convmask(work->dmask, work->nmask, ny2, work->fdmask);
 
-/* Initialize destination buffer to zero if pix2 != NULL */
-  if (!pix2)
-    pix2 = statpix2;
-  else
-    {
-    memset(pix2, 0, (size_t)(w2*h2)*sizeof(float));
-    statpix2 = pix2;
-    }
+/* Initialize destination buffers to zero */
+  memset(pix2, 0, (size_t)(w2*h2)*sizeof(float));
+  memset(pix2x, 0, (size_t)(w2*h2)*sizeof(float));
+  memset(pix2y, 0, (size_t)(w2*h2)*sizeof(float));
 
 /* Make the interpolation in y  and transpose once again */
-  pixin0 = pix12;
-  pixout0 = pix2+ixs2+iys2*w2;
-  for (k=nx2; k--; pixin0+=ny1, pixout0++)
-    {
-    maskt = mask;
-    nmaskt = nmask;
-    startt = start;
-    pixout = pixout0;
-    for (j=ny2; j--; pixout+=w2)
-      {
-      pixin = pixin0+*(startt++);
-      val = 0.0; 
-      for (i=*(nmaskt++); i--;)
-        val += *(maskt++)*(double)*(pixin++);
-      *pixout = (float)val;
-      }
-    }
-
-/* Free memory */
-  free(pix12);
-  free(mask);
-  free(nmask);
-  free(start);
+  off2 = ixs2+iys2*w2;
+  vignet_convsel(work->pix12, ny1, nx2, pix2+off2, w2, work->fmask,
+	mstride, work->nmask, work->start, ny2, work->tile);
+  vignet_convsel(work->pix12x, ny1, nx2, pix2x+off2, w2, work->fmask,
+	mstride, work->nmask, work->start, ny2, work->tile);
+  vignet_convsel(work->pix12, ny1, nx2, pix2y+off2, w2, work->fdmask,
+	mstride, work->nmask, work->start, ny2, work->tile);
 
   return RETURN_OK;
   }
 
+
 /****** vignet_resample_pixel ******************************************************
 PROTO   int     vignet_resample_pixel(float *pix1, int w1, int h1,
                 float *pix2, int w2, int h2, double dx, double dy, float step2,
@@ -281,6 +1369,9 @@ INPUT   Input raster,
         shift in y,
         output pixel scale.
 OUTPUT  RETURN_ERROR if the images do not overlap, RETURN_OK otherwise.
+NOTES   Wrapper to vignet_resample_pixel_work() with a temporary workspace.
+        If s_pix2 is NULL, the output raster of the previous call is reused,
+        which makes this function non-reentrant.
  ***/
 int
 vignet_resample_pixel(const float *s_pix1, const int w1, const int h1, /* input */
@@ -291,6 +1382,48 @@ vignet_resample_pixel(const float *s_pix1, const int w1, const int h1, /* input
 {
    static float	*stat_s_pix2 = NULL;	/* save an old version of s_pix2.  Scary! */
 
+   vignetworkstruct *work = vignet_initwork(w1, h1, w2, h2, stepi);
+   work->pix2 = stat_s_pix2;
+   const int status = vignet_resample_pixel_work(work, s_pix1, w1, h1,
+						 s_pix2, w2, h2, dx, dy, step2, stepi);
+   stat_s_pix2 = work->pix2;
+   vignet_endwork(work);
+
+   return status;
+}
+
+
+/****** vignet_resample_pixel_work ******************************************
+PROTO   int     vignet_resample_pixel_work(vignetworkstruct *work,
+                const float *pix1, int w1, int h1,
+                float *pix2, int w2, int h2, double dx, double dy, float step2,
+                float stepi)
+PURPOSE Scale and shift a small image by computing the overlap function,
+        using a workspace. Image parts which lie outside boundaries are set
+        to 0.
+
+INPUT   Pointer to the workspace (see vignet_initwork()),
+        input raster,
+        input raster width,
+        input raster height,
+        output raster (or NULL to reuse the last one of the workspace),
+        output raster width,
+        output raster height,
+        shift in x,
+        shift in y,
+        output pixel scale.
+OUTPUT  RETURN_ERROR if the images do not overlap, RETURN_OK otherwise.
+NOTES   Both passes run through the vignet_conv() kernel selected for the
+        current CPU.
+ ***/
+int
+vignet_resample_pixel_work(vignetworkstruct *work,
+			   const float *s_pix1, const int w1, const int h1, /* input */
+			   float *s_pix2, const int w2, const int h2,       /* output */
+			   const double dx, const double dy,
+			   const float step2,
+			   float stepi)
+{
    if (stepi <= 0.0) {
       stepi = 1.0;
    }
@@ -363,144 +1496,463 @@ vignet_resample_pixel(const float *s_pix1, const int w1, const int h1, /* input
    ny1 -= iys1a;
    ys1 -= (double)iys1a;
 
+   vignet_growwork(work, nx2 > ny2 ? nx2 : ny2,
+		   nx2*interpw > ny2*interph ? nx2*interpw : ny2*interph, nx2*ny1,
+		   w1 > ny1 ? w1 : ny1, 0);
+
    /* Initialize destination buffer to zero if s_pix2 != NULL */
    if (!s_pix2) {
-      assert(stat_s_pix2 != NULL);
-      s_pix2 = stat_s_pix2;
+      assert(work->pix2 != NULL);
+      s_pix2 = work->pix2;
    } else {
       memset(s_pix2, 0, (size_t)(w2*h2)*sizeof(float));
-      stat_s_pix2 = s_pix2;
+      work->pix2 = s_pix2;
    }
 
-   /* Allocate 2-D arrays for data */
-   const float **pix1; QMALLOC(pix1, const float *, h1);
-   for (int k = 0; k < h1; k++) {
-      pix1[k] = &s_pix1[k*w1];
-   }
+   /* Compute the local interpolant and data starting points in x */
+   int *nmask = work->nmask;	/* Interpolation mask sizes */
+   int *start = work->start;	/* Int part of Im1 conv starts */
+   vignet_pixelmask(xs1, step2, dstepi, nx2, w1, hmw, work->mask, nmask, start);
+   int mstride = vignet_convmask(work->mask, nmask, nx2, work->fmask);
 
-   float **pix2; QMALLOC(pix2, float *, h2);
-   for (int k = 0; k < h2; k++) {
-      pix2[k] = &s_pix2[k*w2];
-   }
+   /* Make the interpolation in x (this includes transposition) */
+   vignet_convsel(&s_pix1[iys1a*w1], w1, ny1, work->pix12, ny1, work->fmask, mstride,
+		  nmask, start, nx2, work->tile);
 
-   /* Allocate interpolant stuff for the x direction */
-   double *s_mask; QMALLOC(s_mask, double, nx2*interpw); /* Storage for interpolation masks */
-   double **mask; QMALLOC(mask, double *, nx2); /* interpolation masks */
-   for (int k = 0; k < nx2; k++) {
-      mask[k] = &s_mask[k*interpw];
-   }
+   /* Compute the local interpolant and data starting points in y */
+   vignet_pixelmask(ys1, step2, dstepi, ny2, ny1, hmh, work->mask, nmask, start);
+   mstride = vignet_convmask(work->mask, nmask, ny2, work->fmask);
 
-   int *nmask;   QMALLOC(nmask, int, nx2);	     /* Interpolation mask sizes */
-   int *start;   QMALLOC(start, int, nx2);	     /* Int part of Im1 conv starts */
+   /* Make the interpolation in y  and transpose once again */
+   vignet_convsel(work->pix12, ny1, nx2, &s_pix2[iys2*w2 + ixs2], w2, work->fmask, mstride,
+		  nmask, start, ny2, work->tile);
 
-   /* Compute the local interpolant and data starting points in x */
-   double x1 = xs1;
-   for (int j = 0; j < nx2; j++, x1 += step2) {
-      const int ix1 = x1;
-      int ix = ix1 - hmw;
-      double dxm = (ix1 - x1 - hmw)*dstepi;/* starting point in the interp. func */
-      int n;
-      if (ix < 0) {
-	 n = interpw + ix;
-	 dxm -= (double)ix*dstepi;
-	 ix = 0;
-      } else {
-	 n = interpw;
+   return RETURN_OK;
+}
+
+
+/****** vignet_resample_batch ************************************************
+PROTO	int	vignet_resample_batch(vignetworkstruct *work,
+		float **pix1, int nsrc, int w1, int h1,
+		float **pix2, int w2, int h2,
+		double *dx, double *dy, int nshift, float step2,
+		float stepi, viginterpenum interp, int nthreads)
+PURPOSE	Resample in one call one raster with many shifts, many rasters with
+	one shift, or many rasters with their own shifts.
+INPUT	Pointer to the workspace (see vignet_initwork()),
+	array of nsrc input rasters,
+	number of input rasters,
+	input raster width,
+	input raster height,
+	array of output rasters,
+	output raster width,
+	output raster height,
+	array of nshift shifts in x,
+	array of nshift shifts in y,
+	number of shifts,
+	output pixel scale,
+	interpolant scale,
+	interpolant (VIGNET_INTERP_SINC or VIGNET_INTERP_PIXEL),
+	number of threads.
+OUTPUT	RETURN_ERROR if some of the images do not overlap, RETURN_OK otherwise.
+NOTES	nsrc and nshift must be 1 or equal to each other; the number of output
+	rasters is the largest of the two. Output i is pix1[i] (or pix1[0])
+	resampled with dx[i],dy[i] (or dx[0],dy[0]), and is identical to the
+	output of vignet_resample_work() (VIGNET_INTERP_SINC) or
+	vignet_resample_pixel_work() (VIGNET_INTERP_PIXEL). Outputs are
+	processed by source and shift, so that the x-pass is made once per
+	source and x-shift, and interpolation masks are computed once per
+	distinct shift. Outputs that do not overlap their input are left
+	untouched. Additional threads get their own workspace.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+int	vignet_resample_batch(vignetworkstruct *work,
+		float **pix1, int nsrc, int w1, int h1,
+		float **pix2, int w2, int h2,
+		double *dx, double *dy, int nshift, float step2,
+		float stepi, viginterpenum interp, int nthreads)
+  {
+   vignetbatchstruct	batch;
+   vignetbatchkeystruct	*key;
+   int			i, n, nok;
+#ifdef USE_THREADS
+   vignetbatchstruct	*tbatch;
+   pthread_t		*thread;
+   pthread_attr_t	pthread_attr;
+   int			p;
+#endif
+
+  n = nsrc>nshift? nsrc : nshift;
+  if (n<1)
+    return RETURN_OK;
+  if ((nsrc!=1 && nsrc!=n) || (nshift!=1 && nshift!=n))
+    error(EXIT_FAILURE, "*Internal Error*: inconsistent numbers of rasters",
+	" and shifts in vignet_resample_batch()");
+
+/* Sort outputs by source and shift */
+  QMALLOC(key, vignetbatchkeystruct, n);
+  for (i=0; i<n; i++)
+    {
+    key[i].index = i;
+    key[i].src = nsrc>1? i : 0;
+    key[i].dx = dx[nshift>1? i : 0];
+    key[i].dy = dy[nshift>1? i : 0];
+    }
+  if (n>1)
+    qsort(key, n, sizeof(vignetbatchkeystruct), vignet_batchkeycmp);
+
+  batch.work = work;
+  batch.key = key;
+  batch.pix1 = pix1;
+  batch.pix2 = pix2;
+  batch.w1 = w1;
+  batch.h1 = h1;
+  batch.w2 = w2;
+  batch.h2 = h2;
+  batch.step2 = step2;
+  batch.stepi = stepi;
+  batch.interp = interp;
+  batch.nstart = 0;
+  batch.nend = n;
+  batch.nok = 0;
+
+  if (nthreads>n)
+    nthreads = n;
+#ifdef USE_THREADS
+  if (nthreads>1)
+    {
+/*-- Split the sorted outputs in contiguous ranges */
+    QMALLOC(tbatch, vignetbatchstruct, nthreads);
+    QMALLOC(thread, pthread_t, nthreads);
+    QPTHREAD_ATTR_INIT(&pthread_attr);
+    QPTHREAD_ATTR_SETDETACHSTATE(&pthread_attr, PTHREAD_CREATE_JOINABLE);
+    for (p=0; p<nthreads; p++)
+      {
+      tbatch[p] = batch;
+      if (p)
+        tbatch[p].work = vignet_initwork(w1,h1, w2,h2, stepi);
+      tbatch[p].nstart = (int)(((long long)n*p)/nthreads);
+      tbatch[p].nend = (int)(((long long)n*(p+1))/nthreads);
+      QPTHREAD_CREATE(&thread[p], &pthread_attr,
+	&pthread_vignet_resample_batch, &tbatch[p]);
       }
-      int t = w1 - ix;
-      if (n > t) {
-	 n = t;
+    nok = 0;
+    for (p=0; p<nthreads; p++)
+      {
+      QPTHREAD_JOIN(thread[p], NULL);
+      nok += tbatch[p].nok;
+      if (p)
+        vignet_endwork(tbatch[p].work);
       }
-      start[j] = ix;
-      nmask[j] = n;
-      double x = dxm;
-#define	INTERPF_LINEAR_DOWN(x)	((fabs(x) > step2) ? 0.0 : step2 - fabs(x))
+    QPTHREAD_ATTR_DESTROY(&pthread_attr);
+    free(thread);
+    free(tbatch);
+    }
+  else
+#endif
+    nok = vignet_resample_batchrange(&batch);
 
-      for (int i = 0; i < n; i++, x += dstepi) {
-	 double pval = INTERPF_LINEAR_DOWN(x);
-	 mask[j][i] = pval;
-      }
-   }
+  free(key);
 
-   float *s_pix_tmp; QCALLOC(s_pix_tmp, float, nx2*ny1); /* Intermediary frame-buffer */
-   float **pix_tmp; QCALLOC(pix_tmp, float *, ny1);
-   for (int k = 0; k < ny1; k++) {
-      pix_tmp[k] = &s_pix_tmp[k*nx2];
-   }
+  return nok<n? RETURN_ERROR : RETURN_OK;
+  }
 
-   /* Make the interpolation in x (this includes transposition) */
-   for (int i = 0; i < ny1; i++) {
-      for (int j = 0; j < nx2; j++) {
-	 float val = 0.0; 
-	 for (int k = 0; k < nmask[j]; k++) {
-	    const double pval = pix1[iys1a + i][start[j] + k];
-	    val += pval*mask[j][k];
-	 }
-	 pix_tmp[i][j] = val;
-      }
-   }
 
-   /* Reallocate interpolant stuff for the y direction */
-   QREALLOC(s_mask, double, ny2*interph);	/* Interpolation masks */
-   QREALLOC(mask, double *, ny2*interph);	/* Interpolation masks */
-   for (int k = 0; k < ny2; k++) {
-      mask[k] = &s_mask[k*interph];
-   }
+/****** vignet_resample_batchrange *******************************************
+PROTO	int	vignet_resample_batchrange(vignetbatchstruct *batch)
+PURPOSE	Resample a range of the sorted outputs of vignet_resample_batch().
+INPUT	Pointer to the batch parameters.
+OUTPUT	Number of outputs that overlap their input.
+NOTES	The x-pass covers all the input lines, and its result is kept until
+	the source or the x-shift changes. The y-pass of each output starts at
+	the line the single resampling functions would have started at, and
+	the kernels give results that do not depend on the line position:
+	outputs are bit-identical to those of the single functions.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+static int	vignet_resample_batchrange(vignetbatchstruct *batch)
+  {
+   vignetworkstruct	*work;
+   vignetbatchkeystruct	*key;
+   float		*pix2;
+   double		xs1,ys1, dstepi, xdx,ydy;
+   float		step2, stepi;
+   int			j,k, w1,h1,w2,h2, nx2,ny2, ixs2,iys2, iys1a,ny1, iy,ny, ya,yb,
+			hmw, interpw, nout, xmstride,ymstride, src, xflag,yflag,
+			nok;
 
-   QREALLOC(nmask, int, ny2);		/* Interpolation mask sizes */
-   QREALLOC(start, int, ny2);		/* Int part of Im1 conv starts */
+  work = batch->work;
+  w1 = batch->w1;
+  h1 = batch->h1;
+  w2 = batch->w2;
+  h2 = batch->h2;
+  step2 = batch->step2;
+  stepi = batch->stepi;
+  if (stepi <= 0.0)
+    stepi = 1.0;
+  dstepi = 1.0/stepi;
+  hmw = (int)((INTERPW/2)/dstepi) + 2;	/* Interpolant start */
+  interpw = 2*hmw;
+  nout = w2>h2? w2 : h2;
+  vignet_growwork(work, nout, nout*interpw, w2*h1, w1>h1? w1:h1, 0);
 
-   /* Compute the local interpolant and data starting points in y */
-   double y1 = ys1;
-   for (int j = 0; j < ny2; j++, y1 += step2) {
-      const int iy1 = y1;
-      int iy = iy1 - hmh;
-      double dym = (iy1 - y1 - hmh)*dstepi;/* starting point in the interp. func */
-      int n;
-      if (iy < 0) {
-	 n = interph + iy;
-	 dym -= (double)iy*dstepi;
-	 iy = 0;
-      } else {
-	 n = interph;
+  xdx = ydy = 0.0;
+  iys1a = ny1 = xmstride = ymstride = 0;
+  src = -1;
+  xflag = yflag = 0;
+  nok = 0;
+  for (k=batch->nstart; k<batch->nend; k++)
+    {
+    key = &batch->key[k];
+    if (!(nx2 = vignet_resampleaxis(w1, w2, key->dx, step2, &xs1, &ixs2))
+	|| !(ny2 = vignet_resampleaxis(h1, h2, key->dy, step2, &ys1, &iys2)))
+      continue;
+    if (!xflag || key->dx != xdx)
+      {
+/*---- Compute the local interpolant and data starting points in x */
+      if (batch->interp == VIGNET_INTERP_PIXEL)
+        vignet_pixelmask(xs1, step2, dstepi, nx2, w1, hmw, work->mask,
+		work->nmask, work->start);
+      else
+        vignet_interpmask(xs1, step2, dstepi, nx2, w1, hmw, work->mask, NULL,
+		work->nmask, work->start);
+      xmstride = vignet_convmask(work->mask, work->nmask, nx2, work->fmask);
+      xdx = key->dx;
+      xflag = 1;
+      src = -1;
       }
-      const int t = ny1 - iy;
-      if (n > t) {
-	 n = t;
+    if (key->src != src)
+      {
+/*---- Find the input lines needed by the outputs sharing this x-pass */
+      ya = h1;
+      yb = 0;
+      for (j=k; j<batch->nend && batch->key[j].src==key->src
+		&& batch->key[j].dx==key->dx; j++)
+        if ((ny2 = vignet_resampleaxis(h1, h2, batch->key[j].dy, step2,
+		&ys1, &iys2)))
+          {
+          vignet_batchyrange(ys1, ny2, h1, step2, hmw, &iy, &ny);
+          if (iy<ya)
+            ya = iy;
+          if (iy+ny>yb)
+            yb = iy+ny;
+          }
+/*---- Make the interpolation in x (this includes transposition) */
+      vignet_convsel(batch->pix1[key->src]+ya*w1, w1, yb-ya, work->pix12+ya,
+		h1, work->fmask, xmstride, work->nmask, work->start, nx2,
+		work->tile);
+      src = key->src;
+      ny2 = vignet_resampleaxis(h1, h2, key->dy, step2, &ys1, &iys2);
       }
-      start[j] = iy;
-      nmask[j] = n;
-
-      double y = dym;
-      for (int k = 0; k < n; k++, y += dstepi) {
-	 const double pval = INTERPF_LINEAR_DOWN(y);
-	 mask[j][k] = pval;
+    if (!yflag || key->dy != ydy)
+      {
+/*---- Set the y-range with some margin for interpolation */
+      vignet_batchyrange(ys1, ny2, h1, step2, hmw, &iys1a, &ny1);
+      ys1 -= (double)iys1a;
+/*---- Compute the local interpolant and data starting points in y */
+      if (batch->interp == VIGNET_INTERP_PIXEL)
+        vignet_pixelmask(ys1, step2, dstepi, ny2, ny1, hmw, work->mask,
+		work->nymask, work->ystart);
+      else
+        vignet_interpmask(ys1, step2, dstepi, ny2, ny1, hmw, work->mask, NULL,
+		work->nymask, work->ystart);
+      ymstride = vignet_convmask(work->mask, work->nymask, ny2, work->fymask);
+      ydy = key->dy;
+      yflag = 1;
       }
-   }
+/*-- Make the interpolation in y  and transpose once again */
+    pix2 = batch->pix2[key->index];
+    memset(pix2, 0, (size_t)(w2*h2)*sizeof(float));
+    vignet_convsel(work->pix12+iys1a, h1, nx2, pix2+ixs2+iys2*w2, w2,
+	work->fymask, ymstride, work->nymask, work->ystart, ny2, work->tile);
+    nok++;
+    }
 
-   /* Make the interpolation in y  and transpose once again */
-   for (int i = 0; i < nx2; i++) {
-      for (int j = 0; j < ny2; j++) {
-	 float val = 0.0; 
-	 for (int k = 0; k < nmask[j]; k++) {
-	    val += pix_tmp[start[j] + k][i]*mask[j][k];
-	 }
-	 pix2[iys2 + j][ixs2 + i] = val;
-      }
-   }
+  return nok;
+  }
 
-   /* Free memory */
-   free(s_pix_tmp);
-   free(pix_tmp);
-   free(pix1);
-   free(pix2);
-   free(s_mask);
-   free(mask);
-   free(nmask);
-   free(start);
 
-   return RETURN_OK;
-}
+/****** vignet_batchyrange ***************************************************
+PROTO	void	vignet_batchyrange(double ys1, int ny2, int h1, float step2,
+		int hmh, int *iys1a, int *ny1)
+PURPOSE	Compute the range of input lines the y-pass of the resampling
+	functions reads, with some margin for interpolation.
+INPUT	Input y-coordinate of the first overlapping output line,
+	number of overlapping output lines,
+	input raster height,
+	output pixel scale,
+	interpolant half-height (input pixels),
+	pointer to the first input line (output),
+	pointer to the number of input lines (output).
+OUTPUT	-.
+NOTES	Same range as in vignet_resample_work().
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+static void	vignet_batchyrange(double ys1, int ny2, int h1, float step2,
+			int hmh, int *iys1a, int *ny1)
+  {
+   int	iy, n;
+
+  iy = (int)ys1;		/* Int part of Im1 start y-coord with margin */
+  if (iy<0 || ((iy -= hmh)< 0))
+    iy = 0;
+  n = (int)(ys1+ny2*step2)+hmh;	/* Interpolated Im1 y size with margin */
+  if (n>h1)
+    n = h1;
+  *iys1a = iy;
+  *ny1 = n - iy;
+
+  return;
+  }
+
+
+/****** vignet_batchkeycmp ****************************************************
+PROTO	int	vignet_batchkeycmp(const void *key1, const void *key2)
+PURPOSE	Sort vignet_resample_batch() outputs by source, then x- and y-shift.
+INPUT	Pointer to the first key,
+	pointer to the second key.
+OUTPUT	<0 if key1 comes first, >0 if key2 comes first.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+static int	vignet_batchkeycmp(const void *key1, const void *key2)
+  {
+   const vignetbatchkeystruct	*k1, *k2;
+
+  k1 = (const vignetbatchkeystruct *)key1;
+  k2 = (const vignetbatchkeystruct *)key2;
+  if (k1->src != k2->src)
+    return k1->src<k2->src? -1 : 1;
+  if (k1->dx != k2->dx)
+    return k1->dx<k2->dx? -1 : 1;
+  if (k1->dy != k2->dy)
+    return k1->dy<k2->dy? -1 : 1;
+
+  return k1->index - k2->index;
+  }
+
+
+#ifdef USE_THREADS
+/****** pthread_vignet_resample_batch *****************************************
+PROTO	void	*pthread_vignet_resample_batch(void *arg)
+PURPOSE	Thread that resamples its range of vignet_resample_batch() outputs.
+INPUT	Pointer to the batch parameters.
+OUTPUT	-.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+static void	*pthread_vignet_resample_batch(void *arg)
+  {
+   vignetbatchstruct	*batch;
+
+  batch = (vignetbatchstruct *)arg;
+  batch->nok = vignet_resample_batchrange(batch);
+
+  pthread_exit(NULL);
+
+  return (void *)NULL;
+  }
+#endif
+
+
+/****** vignet_pixelaxis ******************************************************
+PROTO	int	vignet_pixelaxis(int w1, int w2, double d, float step2,
+		double *pos, int *start)
+PURPOSE	Compute, along one axis, the input coordinates at which
+	vignet_resample_pixel() (with stepi = 1) samples each output pixel.
+INPUT	Input raster size along the axis,
+	output raster size along the axis,
+	shift along the axis,
+	output pixel scale,
+	array of w2 input coordinates (output),
+	pointer to the index of the first overlapping output pixel (output).
+OUTPUT	Number of overlapping output pixels (0 if the images do not overlap).
+NOTES	Only pos[*start] to pos[*start + n - 1] are set.
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+int	vignet_pixelaxis(int w1, int w2, double d, float step2,
+		double *pos, int *start)
+  {
+   double	xs1, x1;
+   int		ixs2, dix2, nx2, i;
+
+  xs1 = (double)(w1/2) + d - (double)(w2/2)*step2;
+  if ((int)xs1 >= w1)
+    return 0;
+  ixs2 = 0;
+  if (xs1 < 0.0)
+    {
+    dix2 = 1 - xs1/step2;
+    if (dix2 >= w2)
+      return 0;
+    ixs2 += dix2;
+    xs1 += dix2*step2;
+    }
+  nx2 = (w1 - 1 - xs1)/step2 + 1;
+  if (nx2 > w2 - ixs2)
+    nx2 = w2 - ixs2;
+  if (nx2 <= 0)
+    return 0;
+  for (x1=xs1, i=0; i<nx2; i++, x1+=step2)
+    pos[ixs2+i] = x1;
+  *start = ixs2;
+
+  return nx2;
+  }
+
+
+/****** vignet_diracaxis ******************************************************
+PROTO	int	vignet_diracaxis(double *pos, int start, int n, float step2,
+		int m, int *out, double *weight)
+PURPOSE	Compute, along one axis, the output pixels and weights that
+	vignet_resample_pixel() (with stepi = 1) assigns to a Dirac peak.
+INPUT	Input coordinates from vignet_pixelaxis(),
+	index of the first overlapping output pixel,
+	number of overlapping output pixels,
+	output pixel scale,
+	input pixel index of the Dirac peak,
+	array of output pixel indices (output),
+	array of weights (output).
+OUTPUT	Number of output pixels with a non-zero weight, in increasing order.
+NOTES	The linear interpolant has a support of ]-step2,step2[ and output
+	pixels are step2 apart: out and weight must hold 3 elements (2 are
+	enough in exact arithmetic).
+AUTHOR	LSST DM (Rubin Observatory)
+VERSION	18/10/2026
+ ***/
+int	vignet_diracaxis(double *pos, int start, int n, float step2,
+		int m, int *out, double *weight)
+  {
+   double	x, pval;
+   int		o, oend, ix1, hmw, nout;
+
+  if (n<=0)
+    return 0;
+  hmw = (INTERPW/2) + 2;
+  oend = start + n;
+/* First output pixel that can be reached by the interpolant */
+  o = start + (int)floor((m - step2 - pos[start])/step2);
+  if (o < start)
+    o = start;
+  for (nout=0; o<oend && (x=m-pos[o]) > -step2; o++)
+    {
+    ix1 = (int)pos[o];
+/*-- Interpolation masks only span [ix1-hmw, ix1+hmw[ */
+    if (m < ix1-hmw || m >= ix1+hmw)
+      continue;
+    if ((pval = INTERPF_LINEAR_DOWN(x)) > 0.0)
+      {
+      out[nout] = o;
+      weight[nout++] = pval;
+      }
+    }
+
+  return nout;
+  }
 
 
 /******************************** vignet_copy ********************************/
@@ -31,10 +31,17 @@
 #define APER_OVERSAMP	5	/* oversampling in each dimension (MAG_APER) */
 #define	INTERPW		9	/* Interpolation function range */
 #define	INTERPFAC	5.0	/* Interpolation envelope factor */
+#define	VIGNET_INTERPRES 1024	/* Interpolant table steps per unit */
 
 #define	INTERPF(x)	(x<1e-5 && x>-1e-5? 1.0 \
 			:(x>INTERPFAC?0.0:(x<-INTERPFAC?0.0 \
 			:sin(PI*x)*sin(PI/INTERPFAC*x)/(PI*PI/INTERPFAC*x*x))))
+#define	INTERPDF(x)	(x<1e-5 && x>-1e-5? 0.0 \
+			:(x>INTERPFAC?0.0:(x<-INTERPFAC?0.0 \
+			:(PI*(cos(PI*x)*sin(PI/INTERPFAC*x) \
+			+ sin(PI*x)*cos(PI/INTERPFAC*x)/INTERPFAC) \
+			- 2.0*sin(PI*x)*sin(PI/INTERPFAC*x)/x) \
+			/(PI*PI/INTERPFAC*x*x))))	/* d INTERPF(x)/dx */
 
 //#define	INTERPF(x)	(fabs(x)>1.0?0.0 : 1 - fabs(x))
 //#define	INTERPF(x)	(fabs(x)>0.5? 0.0:1.0)
@@ -50,17 +57,92 @@
 typedef  enum {VIGNET_CPY, VIGNET_ADD, VIGNET_SUB, VIGNET_MUL, VIGNET_DIV}
 		vigopenum;
 
+typedef  enum {VIGNET_INTERP_SINC, VIGNET_INTERP_PIXEL}
+		viginterpenum;
+
+typedef struct vignetwork
+  {
+  double	*mask;		/* Interpolation masks */
+  double	*dmask;		/* Interpolation mask derivatives */
+  float		*fmask;		/* Interpolation masks (kernel layout) */
+  float		*fdmask;	/* Mask derivatives (kernel layout) */
+  int		*nmask;		/* Interpolation mask sizes */
+  int		*start;		/* Int part of input conv starts */
+  float		*fymask;	/* y interpolation masks (batch mode) */
+  int		*nymask;	/* y interpolation mask sizes (batch mode) */
+  int		*ystart;	/* Int part of input y conv starts (batch) */
+  float		*pix12;		/* Intermediary frame-buffer */
+  float		*pix12x;	/* Intermediary frame-buffer (derivatives) */
+  float		*tile;		/* Tile buffer of the SIMD kernels */
+  float		*pix2;		/* Last output raster (used if pix2 = NULL) */
+  int		nout;		/* Size of nmask and start */
+  int		nmaskel;	/* Size of the mask buffers */
+  int		npix12;		/* Size of the intermediary frame-buffers */
+  int		ntile;		/* Size of the tile buffer */
+  int		gradflag;	/* Derivative buffers allocated? */
+  }	vignetworkstruct;
+
+typedef struct vignetbatchkey
+  {
+  int		index;		/* Output raster index */
+  int		src;		/* Input raster index */
+  double	dx,dy;		/* Shift */
+  }	vignetbatchkeystruct;
+
+typedef struct vignetbatch
+  {
+  vignetworkstruct	*work;	/* Workspace */
+  vignetbatchkeystruct	*key;	/* Outputs sorted by source and shift */
+  float		**pix1;		/* Input rasters */
+  float		**pix2;		/* Output rasters */
+  int		w1,h1;		/* Input raster size */
+  int		w2,h2;		/* Output raster size */
+  float		step2;		/* Output pixel scale */
+  float		stepi;		/* Interpolant scale */
+  viginterpenum	interp;		/* Interpolant */
+  int		nstart,nend;	/* Range of sorted outputs */
+  int		nok;		/* Number of overlapping outputs (output) */
+  }	vignetbatchstruct;
+
 /*---------------------------------- protos --------------------------------*/
+extern vignetworkstruct	*vignet_initwork(int w1, int h1, int w2, int h2,
+				float stepi);
+
+extern void	vignet_endwork(vignetworkstruct *work);
+
 extern int	vignet_copy(float *pix1, int w1, int h1,
 			float *pix2, int w2, int h2, int idx, int idy,
 			vigopenum vigop),
                 vignet_resample(float *pix1, int w1, int h1, float *pix2,
 			int w2, int h2, double dx, double dy, float step2,
                         float stepi),
+		vignet_resample_grad(float *pix1, int w1, int h1,
+			float *pix2, float *pix2x, float *pix2y, int w2, int h2,
+			double dx, double dy, float step2, float stepi),
     	        vignet_resample_pixel(const float *pix1, const int w1, const int h1,
                         float *pix2, const int w2, const int h2,
                         const double dx, const double dy,
-                        const float step2, float stepi);
+                        const float step2, float stepi),
+		vignet_resample_work(vignetworkstruct *work,
+			float *pix1, int w1, int h1, float *pix2, int w2, int h2,
+			double dx, double dy, float step2, float stepi),
+		vignet_resample_grad_work(vignetworkstruct *work,
+			float *pix1, int w1, int h1,
+			float *pix2, float *pix2x, float *pix2y, int w2, int h2,
+			double dx, double dy, float step2, float stepi),
+		vignet_resample_pixel_work(vignetworkstruct *work,
+			const float *pix1, int w1, int h1,
+			float *pix2, int w2, int h2,
+			double dx, double dy, float step2, float stepi),
+		vignet_resample_batch(vignetworkstruct *work,
+			float **pix1, int nsrc, int w1, int h1,
+			float **pix2, int w2, int h2,
+			double *dx, double *dy, int nshift, float step2,
+			float stepi, viginterpenum interp, int nthreads),
+		vignet_diracaxis(double *pos, int start, int n, float step2,
+			int m, int *out, double *weight),
+		vignet_pixelaxis(int w1, int w2, double d, float step2,
+			double *pos, int *start);
 
 extern float	vignet_aperflux(float *ima, float *var, int w, int h,
 			float dxc, float dyc, float aper,
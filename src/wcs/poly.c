@@ -55,6 +55,8 @@
 #include "f2c.h"
 #include "lapack_stub.h"
 
+#include "gsl/gsl_cblas.h"
+
 #define QCALLOC(ptr, typ, nel) \
                 {if (!(ptr = (typ *)calloc((size_t)(nel),sizeof(typ)))) \
                   qerror("Not enough memory for ", \
@@ -419,6 +421,204 @@ int     poly_fit(polystruct *poly, double *x, double *y, double *w, int ndata,
   }
 
 
+/****** poly_fitbatch ********************************************************
+PROTO   int poly_fitbatch(polystruct *poly, double *x, double *y, double *w,
+        int ndata, int nfit, double *extbasis, double regul, double *coeffs)
+PURPOSE Least-Square fits of a multidimensional polynom to a batch of weighted
+        data sets sharing the same inputs to basis functions.
+INPUT   polystruct pointer,
+        pointer to the (pseudo)2D array of inputs to basis functions,
+        pointer to the (pseudo)2D array of data values (ndata x nfit),
+        pointer to the (pseudo)2D array of data weights (ndata x nfit),
+        number of data points,
+        number of data sets to fit,
+        pointer to a (pseudo)2D array of computed basis function values,
+        Tikhonov regularization parameter (0 = no regularization),
+        pointer to the (pseudo)2D array of output coeffs (ncoeff x nfit).
+OUTPUT  Number of fits that had to fall back to poly_fit().
+NOTES   Same conventions as poly_fit() for x and extbasis. All normal matrices
+        are accumulated at once with two GEMMs over the lower triangle of the
+        basis function products, then solved in a Cholesky decomposition
+        vectorized along the batch axis. Fits for which the matrix is found
+        not to be positive definite are redone using poly_fit().
+AUTHOR  LSST DM (Rubin Observatory)
+VERSION 18/10/2026
+ ***/
+int     poly_fitbatch(polystruct *poly, double *x, double *y, double *w,
+                int ndata, int nfit, double *extbasis, double regul,
+                double *coeffs)
+  {
+   void qerror(char *msg1, char *msg2);
+   double       x2[POLY_MAXDIM],
+                *alpha,*alphat, *beta,*betat, *basis,*basist,*basis1,*basis2,
+                *prod,*prodt, *wy,*wyt, *yt,*wt, *ystack,*wstack, *coefft,
+                *diag, *sum;
+   int          *badflag,
+                ncoeff, ndim, nprod, nbad,
+                d,i,j,k,n,p;
+
+  if (!x && !extbasis)
+    qerror("*Internal Error*: One of x or extbasis should be "
+        "different from NULL\nin ", "poly_fitbatch()");
+  ncoeff = poly->ncoeff;
+  ndim = poly->ndim;
+  nprod = (ncoeff*(ncoeff+1))/2;
+
+/* Compute (or retrieve) basis functions for every data point */
+  if (x)
+    {
+    if (extbasis)
+      basis = extbasis;
+    else
+      QMALLOC(basis, double, ndata*ncoeff);
+    for (basist=basis, n=ndata; n--; basist+=ncoeff)
+      {
+      for (d=0; d<ndim; d++)
+        x2[d] = *(x++);
+      poly_func(poly, x2);
+      memcpy(basist, poly->basis, ncoeff*sizeof(double));
+      }
+    }
+  else
+    basis = extbasis;
+
+/* Products of pairs of basis functions (packed lower triangle, row-wise) */
+  QMALLOC(prod, double, ndata*nprod);
+  for (basist=basis, prodt=prod, n=ndata; n--; basist+=ncoeff)
+    for (basis1=basist, j=0; j<ncoeff; j++, basis1++)
+      for (basis2=basist, i=0; i<=j; i++)
+        *(prodt++) = *basis1**(basis2++);
+
+/* Weighted data */
+  QMALLOC(wy, double, ndata*nfit);
+  for (yt=y, wt=w, wyt=wy, i=ndata*nfit; i--;)
+    *(wyt++) = *(yt++)**(wt++);
+
+/* alpha = prod^T . w and beta = basis^T . (w*y), batch index running fastest */
+  QMALLOC(alpha, double, nprod*nfit);
+  QMALLOC(beta, double, ncoeff*nfit);
+  cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans, nprod, nfit, ndata,
+        1.0, prod, nprod, w, nfit, 0.0, alpha, nfit);
+  cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans, ncoeff, nfit, ndata,
+        1.0, basis, ncoeff, wy, nfit, 0.0, beta, nfit);
+  free(prod);
+  free(wy);
+
+  if (regul>POLY_TINY)
+/*-- Simple Tikhonov regularization */
+    for (j=0; j<ncoeff; j++)
+      for (alphat=alpha+((j*(j+3))/2)*nfit, p=nfit; p--;)
+        *(alphat++) += regul;
+
+/* Batched Cholesky decomposition: alpha <- L (packed), diag <- 1/L_jj */
+  QMALLOC(diag, double, ncoeff*nfit);
+  QMALLOC(sum, double, nfit);
+  QCALLOC(badflag, int, nfit);
+  for (j=0; j<ncoeff; j++)
+    for (i=0; i<=j; i++)
+      {
+      memcpy(sum, alpha+((j*(j+1))/2+i)*nfit, nfit*sizeof(double));
+      for (k=0; k<i; k++)
+        {
+        basis1 = alpha+((j*(j+1))/2+k)*nfit;
+        basis2 = alpha+((i*(i+1))/2+k)*nfit;
+#pragma ivdep
+        for (p=0; p<nfit; p++)
+          sum[p] -= basis1[p]*basis2[p];
+        }
+      alphat = alpha+((j*(j+1))/2+i)*nfit;
+      if (i==j)
+        {
+        betat = diag+j*nfit;
+        for (p=0; p<nfit; p++)
+          if (sum[p] > 0.0)
+            betat[p] = 1.0/(alphat[p] = sqrt(sum[p]));
+          else
+            {
+            badflag[p] = 1;
+            alphat[p] = betat[p] = 1.0;
+            }
+        }
+      else
+        {
+        betat = diag+i*nfit;
+#pragma ivdep
+        for (p=0; p<nfit; p++)
+          alphat[p] = sum[p]*betat[p];
+        }
+      }
+
+/* Forward substitution (L.z = beta) */
+  for (j=0; j<ncoeff; j++)
+    {
+    betat = beta+j*nfit;
+    for (k=0; k<j; k++)
+      {
+      basis1 = alpha+((j*(j+1))/2+k)*nfit;
+      basis2 = beta+k*nfit;
+#pragma ivdep
+      for (p=0; p<nfit; p++)
+        betat[p] -= basis1[p]*basis2[p];
+      }
+    for (basis1=diag+j*nfit, p=0; p<nfit; p++)
+      betat[p] *= basis1[p];
+    }
+
+/* Backward substitution (L^T.x = z) */
+  for (j=ncoeff; j--;)
+    {
+    betat = beta+j*nfit;
+    for (k=j+1; k<ncoeff; k++)
+      {
+      basis1 = alpha+((k*(k+1))/2+j)*nfit;
+      basis2 = beta+k*nfit;
+#pragma ivdep
+      for (p=0; p<nfit; p++)
+        betat[p] -= basis1[p]*basis2[p];
+      }
+    for (basis1=diag+j*nfit, p=0; p<nfit; p++)
+      betat[p] *= basis1[p];
+    }
+
+  memcpy(coeffs, beta, ncoeff*nfit*sizeof(double));
+  free(alpha);
+  free(beta);
+  free(diag);
+  free(sum);
+
+/* Redo non-positive definite cases with the reference fitting routine */
+  nbad = 0;
+  for (p=0; p<nfit; p++)
+    if (badflag[p])
+      nbad++;
+  if (nbad)
+    {
+    QMALLOC(ystack, double, ndata);
+    QMALLOC(wstack, double, ndata);
+    for (p=0; p<nfit; p++)
+      if (badflag[p])
+        {
+        for (n=0; n<ndata; n++)
+          {
+          ystack[n] = y[n*nfit+p];
+          wstack[n] = w[n*nfit+p];
+          }
+        poly_fit(poly, NULL, ystack, wstack, ndata, basis, regul);
+        for (coefft=coeffs+p, j=0; j<ncoeff; j++, coefft+=nfit)
+          *coefft = poly->coeff[j];
+        }
+    free(ystack);
+    free(wstack);
+    }
+
+  free(badflag);
+  if (basis != extbasis)
+    free(basis);
+
+  return nbad;
+  }
+
+
 /****** poly_addcste *********************************************************
 PROTO   void poly_addcste(polystruct *poly, double *cste)
 PURPOSE Modify matrix coefficients to mimick the effect of adding a cst to
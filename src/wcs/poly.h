@@ -65,6 +65,9 @@ extern int		cholsolve(double *a, double *b, int n),
 			poly_fit(polystruct *poly, double *x, double *y,
 				double *w, int ndata, double *extbasis,
 				double regul),
+			poly_fitbatch(polystruct *poly, double *x, double *y,
+				double *w, int ndata, int nfit,
+				double *extbasis, double regul, double *coeffs),
 			*poly_powers(polystruct *poly),
 			poly_solve(double *a, double *b, int n);
 
@@ -0,0 +1,190 @@
+/*
+*				half_precision.c
+*
+* Compare PSFs built from FULL and HALF precision sample storage.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+*
+*	This file part of:	PSFEx
+*
+*	License:		GNU General Public License
+*
+*	PSFEx is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+* 	(at your option) any later version.
+*	PSFEx is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*	You should have received a copy of the GNU General Public License
+*	along with PSFEx.  If not, see <http://www.gnu.org/licenses/>.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+/*
+ The same synthetic star field (elliptical Gaussians whose width and
+ ellipticity vary with position, Poisson and background noise, a few
+ outliers) is run through make_psf() with SAMPLE_PRECISION FULL and HALF,
+ for several basis and recentering settings. Both runs must keep the same
+ samples, and the maximum difference between the PSF components, relative
+ to the largest FULL component, must stay below TEST_TOL.
+
+ Usage: half_precision [number_of_samples]
+*/
+
+#include	<math.h>
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+
+#include	"define.h"
+#include	"types.h"
+#include	"globals.h"
+#include	"prefs.h"
+#include	"context.h"
+#include	"psf.h"
+#include	"sample.h"
+
+#include	"test_utils.h"
+
+#define	TEST_VIGSIZE	35	/* Vignette size */
+#define	TEST_PSFSIZE	25	/* PSF size */
+#define	TEST_NSAMPLE	300	/* Default number of samples */
+#define	TEST_TOL	1e-4	/* Max. component error relative to the peak */
+
+/* make_psf() is linked in through makeit2.c, which also loads catalogues */
+setstruct	*load_samples(char **filename, int catindex, int ncat,
+			int ext, int next, contextstruct *context)
+  {
+  error(EXIT_FAILURE, "*Internal Error*: ", "no catalogue in this test");
+  return NULL;
+  }
+
+/* Build the synthetic field; the same seed gives the same samples */
+static setstruct	*test_field(contextstruct *context, int nsample)
+  {
+   setstruct	*set;
+   samplestruct	*sample;
+   float	*vig;
+   double	x,y, xx,yy, sig, e, flux, val;
+   int		n, ix,iy, w;
+
+  test_srand(TEST_SEED);
+  w = TEST_VIGSIZE;
+  set = init_set(context);
+  set->vigsize[0] = set->vigsize[1] = w;
+  set->nvig = w*w;
+  malloc_samples(set, nsample);
+  for (n=0; n<nsample; n++)
+    {
+    sample = set->sample[n];
+    x = 2000.0*test_rand();
+    y = 4000.0*test_rand();
+    sig = 1.2 + 0.3*x/2000.0 + 0.2*y/4000.0;
+    e = 0.1*(y/4000.0 - 0.5);
+    flux = 2e4*(1.0 + 9.0*test_rand());
+    sample->catindex = sample->extindex = 0;
+    sample->objindex = n;
+    sample->x = x;
+    sample->y = y;
+    sample->dx = test_rand() - 0.5;
+    sample->dy = test_rand() - 0.5;
+    sample->norm = flux;
+    sample->backnoise2 = 100.0;
+    sample->gain = 1.0;
+    sample->context[0] = x;
+    sample->context[1] = y;
+    vig = sample->vig;
+    for (iy=0; iy<w; iy++)
+      for (ix=0; ix<w; ix++)
+        {
+        xx = ix - w/2 - sample->dx;
+        yy = iy - w/2 - sample->dy;
+        val = flux/(2.0*PI*sig*sig)
+		*exp(-(xx*xx*(1.0+e) + yy*yy*(1.0-e))/(2.0*sig*sig));
+        *(vig++) = val + sqrt(100.0 + (val>0.0? val : 0.0))*test_grand();
+        }
+    if (n%37==5)
+      sample->vig[w*w/2+3] += 0.5*flux;
+/*-- In HALF mode the weight-maps can only be written through make_weights() */
+    make_weights(set, sample);
+    set->nsample++;
+    }
+  set->contextoffset[0] = 1000.0;
+  set->contextscale[0] = 2000.0;
+  set->contextoffset[1] = 2000.0;
+  set->contextscale[1] = 4000.0;
+  set->fwhm = 2.35*1.45;
+
+  return set;
+  }
+
+int	main(int argc, char **argv)
+  {
+   static const int	basistypes[] = {BASIS_NONE, BASIS_PIXEL,
+				BASIS_GAUSS_LAGUERRE, BASIS_GAUSS_LAGUERRE},
+			basisnumbers[] = {0, 20, 8, 8},
+			recenters[] = {0, 0, 0, 1};
+   static const char	*basisnames[] = {"NONE", "PIXEL", "GAUSS-LAGUERRE",
+				"GAUSS-LAGUERRE"};
+   char			*names[2] = {"X_IMAGE", "Y_IMAGE"};
+   int			group[2] = {1,1}, deg[1] = {2};
+   contextstruct	*context;
+   setstruct		*set[2];
+   psfstruct		*psf[2];
+   double		err,errmax, peak;
+   int			c,i,n,p, nsample, sameflag;
+
+  nsample = argc>1? atoi(argv[1]) : TEST_NSAMPLE;
+  if (nsample<50)
+    nsample = 50;
+  context = context_init(names, group, 2, deg, 1, CONTEXT_REMOVEHIDDEN);
+  printf("basis            recenter  samples  max.rel.error\n");
+  for (c=0; c<4; c++)
+    {
+    for (p=0; p<2; p++)
+      {
+      memset(&prefs, 0, sizeof(prefs));
+      prefs.psf_size[0] = prefs.psf_size[1] = TEST_PSFSIZE;
+      prefs.psf_pixsize[0] = prefs.psf_pixsize[1] = 1.0;
+      prefs.prof_accuracy = 0.01;
+      prefs.basis_type = basistypes[c];
+      prefs.basis_number = basisnumbers[c];
+      prefs.basis_scale = 1.0;
+      prefs.basis_shiftinterp = 1;
+      prefs.context_nsnap = 9;
+      prefs.recenter_flag = recenters[c];
+      prefs.nthreads = 1;
+      prefs.verbose_type = QUIET;
+      prefs.sample_precision = p? SAMPLE_PRECISION_HALF : SAMPLE_PRECISION_FULL;
+      set[p] = test_field(context, nsample);
+      psf[p] = make_psf(set[p], (set[p]->fwhm/2.35)*0.5, NULL, 0, context);
+      }
+    sameflag = (set[0]->nsample == set[1]->nsample);
+    for (n=0; sameflag && n<set[0]->nsample; n++)
+      if (set[0]->sample[n]->objindex != set[1]->sample[n]->objindex)
+        sameflag = 0;
+    peak = errmax = 0.0;
+    for (i=0; i<psf[0]->npix; i++)
+      {
+      if (fabs(psf[0]->comp[i]) > peak)
+        peak = fabs(psf[0]->comp[i]);
+      err = fabs(psf[1]->comp[i] - psf[0]->comp[i]);
+      if (!(err <= errmax))
+        errmax = err;
+      }
+    errmax = peak>0.0? errmax/peak : 1.0;
+    printf("%-16s %-8s  %-7s  %12.3g\n", basisnames[c],
+	recenters[c]? "yes":"no", sameflag? "same":"DIFFER", errmax);
+    test_check(sameflag? errmax : HUGE_VAL, TEST_TOL);
+    for (p=0; p<2; p++)
+      {
+      psf_end(psf[p]);
+      end_set(set[p]);
+      }
+    }
+  context_end(context);
+
+  return test_end();
+  }
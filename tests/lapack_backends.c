@@ -0,0 +1,312 @@
+/*
+*				lapack_backends.c
+*
+* Check and time the LAPACK backend (see lapack_stub.h).
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+*
+*	This file part of:	PSFEx
+*
+*	License:		GNU General Public License
+*
+*	PSFEx is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+* 	(at your option) any later version.
+*	PSFEx is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*	You should have received a copy of the GNU General Public License
+*	along with PSFEx.  If not, see <http://www.gnu.org/licenses/>.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+/*
+ The same program is linked with each backend (lapack_stub.cc, lapack_system.c
+ or lapack_blocked.c). It solves fixed symmetric positive-definite systems
+ with a known solution, passing only the triangle selected by UPLO (the other
+ one is filled with NaNs), in dense and packed storage, and checks that the
+ solutions agree with the exact one. It also inverts fixed triangular
+ matrices for both UPLO and DIAG values, with LDA > N and NaNs in every
+ element that must not be referenced, and checks both the inverse and that
+ these elements are left untouched. As the same problems are solved by every
+ backend, passing the test means that the backends are interchangeable.
+
+ The wall-clock time taken by DPOSV, DPPSV and DTRTRI is then reported for
+ systems of increasing order (1000, 2000 and 4000 by default). With multithreading,
+ the INTERNAL backend uses all the available processors.
+
+ Usage: lapack_backends [benchmark_order ...]
+*/
+
+#include	<math.h>
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#ifdef USE_THREADS
+#include	<unistd.h>
+
+#include	"define.h"
+#include	"types.h"
+#include	"globals.h"
+#include	"fits/fitscat.h"
+#include	"prefs.h"
+#endif
+#include	"lapack_stub.h"
+
+#include	"test_utils.h"
+
+#ifndef TEST_BACKEND
+#define	TEST_BACKEND	"?"	/* Backend name, set by tests/CMakeLists.txt */
+#endif
+#define	TEST_N		200	/* Order of the test systems */
+#define	TEST_TOL	1e-9	/* Max. relative error on the solution */
+
+static const int	test_benchn[] = {1000, 2000, 4000};	/* Default orders */
+static const int	test_trin[] = {1, 5, 64, 150};	/* Orders of DTRTRI tests */
+
+#ifdef USE_THREADS
+prefstruct		prefs;	/* Only nthreads is used by the backends */
+#endif
+
+/*
+ Make a symmetric positive-definite system of order n with a known solution.
+ Only the triangle given by uplo is kept in a (column-major), the other one
+ being filled with NaNs. The packed version of the same triangle is put in ap.
+*/
+static void	test_makesystem(int n, char uplo, double *a, double *ap,
+			double *b, double *x)
+  {
+   double	val;
+   int		i,j, p;
+
+/* Diagonally dominant, hence positive-definite */
+  test_srand(TEST_SEED);
+  for (j=0; j<n; j++)
+    for (i=j; i<n; i++)
+      a[i+j*n] = a[j+i*n] = (i==j)? (double)n : test_rand() - 0.5;
+  for (i=0; i<n; i++)
+    x[i] = test_rand() - 0.5;
+  for (i=0; i<n; i++)
+    {
+    val = 0.0;
+    for (j=0; j<n; j++)
+      val += a[i+j*n]*x[j];
+    b[i] = val;
+    }
+/* Packed columnwise, as in LAPACK */
+  p = 0;
+  for (j=0; j<n; j++)
+    if (uplo=='L')
+      for (i=j; i<n; i++)
+        ap[p++] = a[i+j*n];
+    else
+      for (i=0; i<=j; i++)
+        ap[p++] = a[i+j*n];
+  for (j=0; j<n; j++)
+    for (i=0; i<n; i++)
+      if (uplo=='L'? i<j : i>j)
+        a[i+j*n] = NAN;
+
+  return;
+  }
+
+/* Max. relative error of a solution */
+static double	test_error(int n, const double *b, const double *x)
+  {
+   double	err, norm;
+   int		i;
+
+  err = norm = 0.0;
+  for (i=0; i<n; i++)
+    {
+    if (!(fabs(b[i]-x[i]) <= err))
+      err = fabs(b[i]-x[i]);
+    if (fabs(x[i]) > norm)
+      norm = fabs(x[i]);
+    }
+
+  return err/norm;
+  }
+
+/* Solve a system in dense or packed storage, return the solver time */
+static double	test_solve(int n, char uplo, int packflag, double *err)
+  {
+   double	*a, *ap, *b, *x;
+   double	t;
+   long		num, one, info;
+   char		str[2];
+
+  a = malloc((size_t)n*n*sizeof(double));
+  ap = malloc((size_t)n*(n+1)/2*sizeof(double));
+  b = malloc(n*sizeof(double));
+  x = malloc(n*sizeof(double));
+  test_makesystem(n, uplo, a, ap, b, x);
+  str[0] = uplo;
+  str[1] = '\0';
+  num = n;
+  one = 1;
+  info = -1;
+  t = test_walltime();
+  if (packflag)
+    dppsv_internal(str, &num, &one, ap, b, &num, &info);
+  else
+    dposv_internal(str, &num, &one, a, &num, b, &num, &info);
+  t = test_walltime() - t;
+  *err = info? HUGE_VAL : test_error(n, b, x);
+  free(a);
+  free(ap);
+  free(b);
+  free(x);
+
+  return t;
+  }
+
+/*
+ 3x3 system filled like the recentering matrix of psf_makeresi_center(): only
+ the upper triangle in row-major order is set, the rest being 0.
+*/
+static double	test_small(void)
+  {
+   static const double	full[9] = {4.0, 1.0, 0.5,
+				   1.0, 3.0,-0.25,
+				   0.5,-0.25,2.0},
+			x[3] = {0.25, -1.5, 0.75};
+   double		amat[9], bmat[3];
+   long			three, one, info;
+   int			i,j;
+
+  for (i=0; i<3; i++)
+    {
+    bmat[i] = 0.0;
+    for (j=0; j<3; j++)
+      {
+      bmat[i] += full[i*3+j]*x[j];
+      amat[i*3+j] = j>=i? full[i*3+j] : 0.0;
+      }
+    }
+  three = 3;
+  one = 1;
+  info = -1;
+  dposv_internal("L", &three, &one, amat, &three, bmat, &three, &info);
+
+  return info? HUGE_VAL : test_error(3, bmat, x);
+  }
+
+/*
+ Invert a triangular matrix of order n stored with leading dimension lda >= n,
+ in the triangle given by uplo, with a unit diagonal if diag is 'U'. Every
+ element that must not be referenced is set to NaN. Return the solver time,
+ and in err (if not NULL) the max. error on the product with the original
+ matrix (relative to the identity) or HUGE_VAL if one of those elements was
+ modified.
+*/
+static double	test_trtri(int n, int lda, char uplo, char diag, double *err)
+  {
+   double	*a, *a0, t, val;
+   long		num, ld, info;
+   int		i,j,k, in;
+   char		str1[2], str2[2];
+
+  a = malloc((size_t)lda*n*sizeof(double));
+  a0 = malloc((size_t)lda*n*sizeof(double));
+  test_srand(TEST_SEED);
+  for (j=0; j<n; j++)
+    for (i=0; i<lda; i++)
+      {
+      in = i<n && (uplo=='L'? i>=j : i<=j);
+      if (i==j)
+        a[i+j*lda] = diag=='U'? NAN : 1.0 + test_rand();
+      else
+        a[i+j*lda] = in? (test_rand() - 0.5)/n : NAN;
+      }
+  memcpy(a0, a, (size_t)lda*n*sizeof(double));
+  str1[0] = uplo;
+  str2[0] = diag;
+  str1[1] = str2[1] = '\0';
+  num = n;
+  ld = lda;
+  info = -1;
+  t = test_walltime();
+  dtrtri_internal(str1, str2, &num, a, &ld, &info);
+  t = test_walltime() - t;
+  if (!err)
+    {
+    free(a);
+    free(a0);
+    return t;
+    }
+  *err = info? HUGE_VAL : 0.0;
+/* Elements outside the triangle must be left as they were */
+  for (j=0; j<n; j++)
+    for (i=0; i<lda; i++)
+      if (isnan(a0[i+j*lda]) && !isnan(a[i+j*lda]))
+        *err = HUGE_VAL;
+/* Product of the original matrix with its inverse, both triangular */
+  for (j=0; j<n && *err<HUGE_VAL; j++)
+    for (i=(uplo=='L'? j:0); i<(uplo=='L'? n:j+1); i++)
+      {
+      val = 0.0;
+      for (k=(uplo=='L'? j:i); k<=(uplo=='L'? i:j); k++)
+        val += (k==i && diag=='U'? 1.0 : a0[i+k*lda])
+		*(k==j && diag=='U'? 1.0 : a[k+j*lda]);
+      val = fabs(val - (i==j? 1.0 : 0.0));
+      if (!(val <= *err))
+        *err = val;
+      }
+  free(a);
+  free(a0);
+
+  return t;
+  }
+
+int	main(int argc, char **argv)
+  {
+   static const char	uplos[2] = {'L', 'U'}, diags[2] = {'N', 'U'};
+   double		err, t1, t2, t3;
+   int			d,i,p, n, nbench;
+
+#ifdef USE_THREADS
+  prefs.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (prefs.nthreads < 1)
+    prefs.nthreads = 1;
+#endif
+  for (p=0; p<2; p++)
+    for (i=0; i<2; i++)
+      {
+      test_solve(TEST_N, uplos[i], p, &err);
+      printf("%s UPLO=%c n=%d: max. relative error %.3g\n",
+	p? "dppsv" : "dposv", uplos[i], TEST_N, err);
+      test_check(err, TEST_TOL);
+      }
+  err = test_small();
+  printf("dposv UPLO=L n=3 (row-major upper triangle): max. relative error"
+	" %.3g\n", err);
+  test_check(err, TEST_TOL);
+  for (n=0; n<(int)(sizeof(test_trin)/sizeof(int)); n++)
+    for (i=0; i<2; i++)
+      for (d=0; d<2; d++)
+        {
+        test_trtri(test_trin[n], test_trin[n]+3, uplos[i], diags[d], &err);
+        printf("dtrtri UPLO=%c DIAG=%c n=%d lda=%d: max. error %.3g\n",
+		uplos[i], diags[d], test_trin[n], test_trin[n]+3, err);
+        test_check(err, TEST_TOL);
+        }
+
+/* Benchmark */
+  nbench = argc>1? argc-1 : (int)(sizeof(test_benchn)/sizeof(int));
+  for (i=0; i<nbench; i++)
+    {
+    n = argc>1? atoi(argv[i+1]) : test_benchn[i];
+    if (n<1)
+      continue;
+    t1 = test_solve(n, 'L', 0, &err);
+    t2 = test_solve(n, 'L', 1, &err);
+    t3 = test_trtri(n, n, 'L', 'N', NULL);
+    printf("Benchmark %s n=%d: dposv %.3f s, dppsv %.3f s, dtrtri %.3f s\n",
+	TEST_BACKEND, n, t1, t2, t3);
+    }
+
+  return test_end();
+  }
@@ -0,0 +1,271 @@
+/*
+*				refine_sparsedot.c
+*
+* Time the design matrix products of the PSF refinement.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+*
+*	This file part of:	PSFEx
+*
+*	License:		GNU General Public License
+*
+*	PSFEx is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+* 	(at your option) any later version.
+*	PSFEx is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*	You should have received a copy of the GNU General Public License
+*	along with PSFEx.  If not, see <http://www.gnu.org/licenses/>.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+/*
+ psf_refine_accum() forms D^T.D for the sparse design matrix D of each sample
+ (one row per basis vector). This program builds the same rows in both the
+ former run-length storage, combined pairwise through a merge loop, and the
+ CSR storage, scattered into a full vignet and gathered with psf_sparsedot().
+ Rows are 2x2 and 3x3 interpolation stencils of shifted pixel basis vectors,
+ or dense rows as obtained with smooth bases. Both products must agree to
+ within TEST_TOL; the time per sample of each is reported.
+
+ Usage: refine_sparsedot [number_of_repeats]
+*/
+
+#include	<math.h>
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+
+#include	"define.h"
+#include	"types.h"
+#include	"globals.h"
+#include	"prefs.h"
+#include	"context.h"
+#include	"psf.h"
+#include	"sample.h"
+
+#include	"test_utils.h"
+
+#define	TEST_VIGSIZE	35	/* Vignette size */
+#define	TEST_NREPEAT	200	/* Default number of repeats */
+#define	TEST_TOL	1e-12	/* Max. relative difference between products */
+
+/* psf_sparsedot() is linked in with sample_utils.c, which loads catalogues */
+setstruct	*load_samples(char **filename, int catindex, int ncat,
+			int ext, int next, contextstruct *context)
+  {
+  error(EXIT_FAILURE, "*Internal Error*: ", "no catalogue in this test");
+  return NULL;
+  }
+
+/* One design matrix in both storage formats */
+typedef struct
+  {
+  int		npsf;		/* Number of rows (basis vectors) */
+  int		ndata;		/* Slot size of the run-length storage */
+  double	*rlmat;		/* Run-length values (npsf slots) */
+  int		*rlindex;	/* Index increments, 0-terminated (npsf slots) */
+  double	*val;		/* CSR values */
+  int		*index;		/* CSR absolute pixel indices */
+  int		*row;		/* CSR row pointers (npsf+1) */
+  }	testdesstruct;
+
+/*
+ Build npsf rows of a w x w vignet. With a stencil size s>0, row k holds the
+ s x s pixels starting at basis pixel k; with s=0 it holds nnz random pixels.
+*/
+static testdesstruct	*test_makedes(int npsf, int w, int s, int nnz)
+  {
+   testdesstruct	*des;
+   double		*rlmat;
+   int			*rlindex, *pix,
+			i,j,k, n, x0,y0, jo, nvpix, nw;
+
+  nvpix = w*w;
+  des = calloc(1, sizeof(testdesstruct));
+  des->npsf = npsf;
+  des->ndata = nvpix+1;
+  n = s? s*s : nnz;
+  des->rlmat = calloc((size_t)npsf*des->ndata, sizeof(double));
+  des->rlindex = calloc((size_t)npsf*des->ndata, sizeof(int));
+  des->val = malloc((size_t)npsf*n*sizeof(double));
+  des->index = malloc((size_t)npsf*n*sizeof(int));
+  des->row = malloc((npsf+1)*sizeof(int));
+  pix = malloc(n*sizeof(int));
+  test_srand(TEST_SEED);
+  nw = w - s - 1;
+  for (k=0; k<npsf; k++)
+    {
+    if (s)
+      {
+/*---- Interpolation stencil of basis pixel k, inside the vignet */
+      x0 = 1 + k%nw;
+      y0 = 1 + (k/nw)%nw;
+      for (j=0; j<s; j++)
+        for (i=0; i<s; i++)
+          pix[j*s+i] = (y0+j)*w + x0+i;
+      }
+    else
+      {
+/*---- Distinct random pixels, in increasing order */
+      for (i=0; i<n; i++)
+        pix[i] = i*(nvpix/n) + (int)(test_rand()*(nvpix/n));
+      }
+    des->row[k] = k*n;
+    rlmat = des->rlmat + (size_t)k*des->ndata;
+    rlindex = des->rlindex + (size_t)k*des->ndata;
+    jo = 0;
+    for (i=0; i<n; i++)
+      {
+      des->val[k*n+i] = *(rlmat++) = test_rand() - 0.5;
+      des->index[k*n+i] = pix[i];
+      *(rlindex++) = pix[i]+1-jo;
+      jo = pix[i]+1;
+      }
+    *rlindex = 0;
+    }
+  des->row[npsf] = npsf*n;
+  free(pix);
+
+  return des;
+  }
+
+static void	test_enddes(testdesstruct *des)
+  {
+  free(des->rlmat);
+  free(des->rlindex);
+  free(des->val);
+  free(des->index);
+  free(des->row);
+  free(des);
+
+  return;
+  }
+
+/* Upper triangle of D^T.D through the former pairwise merge */
+static void	test_merge(testdesstruct *des, double *dtd)
+  {
+   double	*desmat0,*desmat02, *desmatt,*desmatt2, dval;
+   int		*desindex0,*desindex02, *desindext,*desindext2,
+		j,k, dindex, ndata, npsf;
+
+  npsf = des->npsf;
+  ndata = des->ndata;
+  for (desmat0=des->rlmat, desindex0=des->rlindex, k=0; k<npsf;
+	desmat0+=ndata, desindex0+=ndata, k++)
+    for (desmat02=desmat0, desindex02=desindex0, j=k; j<npsf;
+	desmat02+=ndata, desindex02+=ndata, j++)
+      {
+      dval = 0.0;
+      desmatt=desmat0;
+      desmatt2=desmat02;
+      desindext=desindex0;
+      desindext2=desindex02;
+      dindex=*desindext-*desindext2;
+      while (*desindext && *desindext2)
+        {
+        while (*desindext && dindex<0)
+          {
+          dindex+=*(++desindext);
+          desmatt++;
+          }
+        while (*desindext2 && dindex>0)
+          {
+          dindex-=*(++desindext2);
+          desmatt2++;
+          }
+        while (*desindext && !dindex)
+          {
+          dval += *(desmatt++)**(desmatt2++);
+          dindex = *(++desindext)-*(++desindext2);
+          }
+        }
+      dtd[k*npsf+j] = dval;
+      }
+
+  return;
+  }
+
+/* Upper triangle of D^T.D as in psf_refine_accum() */
+static void	test_csr(testdesstruct *des, double *desvec, int nvpix,
+			double *dtd)
+  {
+   const double	*desmat;
+   const int	*desindex, *desrow;
+   int		j,k,l, kmin,kmax, npsf;
+
+  npsf = des->npsf;
+  desmat = des->val;
+  desindex = des->index;
+  desrow = des->row;
+  for (k=0; k<npsf; k++)
+    {
+    for (l=desrow[k]; l<desrow[k+1]; l++)
+      desvec[desindex[l]] = desmat[l];
+    kmin = desrow[k+1]>desrow[k]? desindex[desrow[k]] : nvpix;
+    kmax = desrow[k+1]>desrow[k]? desindex[desrow[k+1]-1] : -1;
+    for (j=k; j<npsf; j++)
+      dtd[k*npsf+j] = (desrow[j+1]>desrow[j] && desindex[desrow[j]]<=kmax
+		&& desindex[desrow[j+1]-1]>=kmin)?
+		psf_sparsedot(desmat+desrow[j], desindex+desrow[j],
+			desrow[j+1]-desrow[j], desvec)
+		: 0.0;
+    for (l=desrow[k]; l<desrow[k+1]; l++)
+      desvec[desindex[l]] = 0.0;
+    }
+
+  return;
+  }
+
+int	main(int argc, char **argv)
+  {
+   static const int	npsfs[] = {336, 336, 600, 45},
+			stencils[] = {2, 3, 2, 0},
+			nnzs[] = {4, 9, 4, 200};
+   testdesstruct	*des;
+   double		*dtd1,*dtd2, *desvec, t1,t2, err,norm;
+   int			c,i,r, npsf, nvpix, nrepeat;
+
+  nrepeat = argc>1? atoi(argv[1]) : TEST_NREPEAT;
+  if (nrepeat<1)
+    nrepeat = 1;
+  nvpix = TEST_VIGSIZE*TEST_VIGSIZE;
+  desvec = calloc(nvpix, sizeof(double));
+  printf(" rows  nnz/row  merge (us)    CSR (us)  max.rel.diff\n");
+  for (c=0; c<4; c++)
+    {
+    npsf = npsfs[c];
+    des = test_makedes(npsf, TEST_VIGSIZE, stencils[c], nnzs[c]);
+    dtd1 = calloc((size_t)npsf*npsf, sizeof(double));
+    dtd2 = calloc((size_t)npsf*npsf, sizeof(double));
+    t1 = test_walltime();
+    for (r=0; r<nrepeat; r++)
+      test_merge(des, dtd1);
+    t1 = (test_walltime() - t1)/nrepeat;
+    t2 = test_walltime();
+    for (r=0; r<nrepeat; r++)
+      test_csr(des, desvec, nvpix, dtd2);
+    t2 = (test_walltime() - t2)/nrepeat;
+    err = norm = 0.0;
+    for (i=0; i<npsf*npsf; i++)
+      {
+      if (!(fabs(dtd1[i]-dtd2[i]) <= err))
+        err = fabs(dtd1[i]-dtd2[i]);
+      if (fabs(dtd1[i]) > norm)
+        norm = fabs(dtd1[i]);
+      }
+    err = norm>0.0? err/norm : HUGE_VAL;
+    printf("%5d  %7d  %10.1f  %10.1f  %12.3g\n",
+	npsf, nnzs[c], t1*1e6, t2*1e6, err);
+    test_check(err, TEST_TOL);
+    free(dtd1);
+    free(dtd2);
+    test_enddes(des);
+    }
+  free(desvec);
+
+  return test_end();
+  }
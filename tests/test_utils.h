@@ -0,0 +1,98 @@
+/*
+*				test_utils.h
+*
+* Helpers shared by the test and benchmark programs.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+*
+*	This file part of:	PSFEx
+*
+*	License:		GNU General Public License
+*
+*	PSFEx is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+* 	(at your option) any later version.
+*	PSFEx is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*	You should have received a copy of the GNU General Public License
+*	along with PSFEx.  If not, see <http://www.gnu.org/licenses/>.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#ifndef _TEST_UTILS_H_
+#define _TEST_UTILS_H_
+
+#include	<math.h>
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<time.h>
+
+/*--------------------------------- constants -------------------------------*/
+
+#define	TEST_SEED	12345ULL	/* Default seed of the random sequence */
+#define	TEST_2PI	6.283185307179586
+
+/*--------------------------------- globals ---------------------------------*/
+
+static unsigned long long	test_seed = TEST_SEED;
+static int			test_nfail;
+
+/*-------------------------------- functions --------------------------------*/
+
+/* Restart the deterministic random sequence */
+static inline void	test_srand(unsigned long long seed)
+  {
+  test_seed = seed;
+  }
+
+/* Deterministic uniform random numbers in [0,1[ */
+static inline double	test_rand(void)
+  {
+  test_seed = test_seed*6364136223846793005ULL + 1442695040888963407ULL;
+  return (double)(test_seed>>11)*(1.0/9007199254740992.0);
+  }
+
+/* Deterministic normal random numbers */
+static inline double	test_grand(void)
+  {
+   double	u, v;
+
+  u = test_rand() + 1e-300;
+  v = test_rand();
+  return sqrt(-2.0*log(u))*cos(TEST_2PI*v);
+  }
+
+/* Wall-clock time in seconds (process time if there is no POSIX clock) */
+static inline double	test_walltime(void)
+  {
+#ifdef CLOCK_MONOTONIC
+   struct timespec	ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + 1e-9*(double)ts.tv_nsec;
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+  }
+
+/* Count a failure unless val <= tol (NaNs fail); return 1 if it passed */
+static inline int	test_check(double val, double tol)
+  {
+  if (val <= tol)
+    return 1;
+  test_nfail++;
+  return 0;
+  }
+
+/* Report the failures; return the exit status of the test program */
+static inline int	test_end(void)
+  {
+  if (test_nfail)
+    printf("%d test(s) failed\n", test_nfail);
+  return test_nfail? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+#endif
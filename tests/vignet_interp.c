@@ -0,0 +1,318 @@
+/*
+*				vignet_interp.c
+*
+* Check and time the tabulated interpolant of vignet_resample().
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+*
+*	This file part of:	PSFEx
+*
+*	License:		GNU General Public License
+*
+*	PSFEx is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+* 	(at your option) any later version.
+*	PSFEx is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*	You should have received a copy of the GNU General Public License
+*	along with PSFEx.  If not, see <http://www.gnu.org/licenses/>.
+*
+*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+/*
+ vignet_resample() reads the interpolant from tables (VIGNET_INTERPRES steps
+ per unit). It is compared here with the previous implementation, which
+ evaluates the analytic interpolant INTERPF() for every tap, on random
+ sub-pixel shifts of a noisy Gaussian, for several output and interpolant
+ scales. The maximum error relative to the peak of the analytic output must
+ stay below TEST_TOL, and integer shifts at scale 1 must give exact copies of
+ the input. The time per call of both versions is reported.
+
+ Usage: vignet_interp [number_of_shifts]
+*/
+
+#include	<math.h>
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<time.h>
+
+#include	"define.h"
+#include	"types.h"
+#include	"globals.h"
+#include	"vignet.h"
+
+#include	"test_utils.h"
+
+#define	TEST_W1		41	/* Input raster size */
+#define	TEST_W2		33	/* Output raster size */
+#define	TEST_NSHIFT	200	/* Default number of random shifts */
+#define	TEST_TOL	1e-6	/* Max. error relative to the peak */
+
+/*
+ Resampling with the analytic interpolant: vignet_resample() as it was
+ before the interpolant was tabulated (pix2 must not be NULL).
+*/
+static int	test_resample_analytic(float *pix1, int w1, int h1,
+			float *pix2, int w2, int h2, double dx, double dy,
+			float step2, float stepi)
+  {
+   double	*mask,*maskt, mx1,mx2,my1,my2, xs1,ys1, x1,y1, x,y, dxm,dym,
+		val, dstepi, norm;
+   float	*pix12, *pixin,*pixin0, *pixout,*pixout0;
+   int		i,j,k,n,t, *start,*startt, *nmask,*nmaskt,
+		ixs2,iys2, ix2,iy2, dix2,diy2, nx2,ny2, iys1a, ny1, hmw,hmh,
+		ix,iy, ix1,iy1, interpw, interph;
+
+  if (stepi <= 0.0)
+    stepi = 1.0;
+  dstepi = 1.0/stepi;
+  mx1 = (double)(w1/2);
+  mx2 = (double)(w2/2);
+  xs1 = mx1 + dx - mx2*step2;
+  if ((int)xs1 >= w1)
+    return RETURN_ERROR;
+  ixs2 = 0;
+  if (xs1<0.0)
+    {
+    dix2 = (int)(1-xs1/step2);
+    if (dix2 >= w2)
+      return RETURN_ERROR;
+    ixs2 += dix2;
+    xs1 += dix2*step2;
+    }
+  nx2 = (int)((w1-1-xs1)/step2+1);
+  if (nx2>(ix2=w2-ixs2))
+    nx2 = ix2;
+  if (nx2<=0)
+    return RETURN_ERROR;
+  my1 = (double)(h1/2);
+  my2 = (double)(h2/2);
+  ys1 = my1 + dy - my2*step2;
+  if ((int)ys1 >= h1)
+    return RETURN_ERROR;
+  iys2 = 0;
+  if (ys1<0.0)
+    {
+    diy2 = (int)(1-ys1/step2);
+    if (diy2 >= h2)
+      return RETURN_ERROR;
+    iys2 += diy2;
+    ys1 += diy2*step2;
+    }
+  ny2 = (int)((h1-1-ys1)/step2+1);
+  if (ny2>(iy2=h2-iys2))
+    ny2 = iy2;
+  if (ny2<=0)
+    return RETURN_ERROR;
+
+  iys1a = (int)ys1;
+  hmh = (int)((INTERPW/2)/dstepi) + 2;
+  interph = 2*hmh;
+  hmw = (int)((INTERPW/2)/dstepi) + 2;
+  interpw =  2*hmw;
+  if (iys1a<0 || ((iys1a -= hmh)< 0))
+    iys1a = 0;
+  ny1 = (int)(ys1+ny2*step2)+interpw-hmh;
+  if (ny1>h1)
+    ny1 = h1;
+  ny1 -= iys1a;
+  ys1 -= (double)iys1a;
+
+  mask = malloc((size_t)(nx2>ny2? nx2:ny2)*(interpw>interph? interpw:interph)
+		*sizeof(double));
+  nmask = malloc((nx2>ny2? nx2:ny2)*sizeof(int));
+  start = malloc((nx2>ny2? nx2:ny2)*sizeof(int));
+  x1 = xs1;
+  maskt = mask;
+  nmaskt = nmask;
+  startt = start;
+  for (j=nx2; j--; x1+=step2)
+    {
+    ix = (ix1=(int)x1) - hmw;
+    dxm = (ix1 - x1 - hmw)*dstepi;
+    if (ix < 0)
+      {
+      n = interpw+ix;
+      dxm -= (double)ix*dstepi;
+      ix = 0;
+      }
+    else
+      n = interpw;
+    if (n>(t=w1-ix))
+      n=t;
+    *(startt++) = ix;
+    *(nmaskt++) = n;
+    norm = 0.0;
+    for (x=dxm, i=n; i--; x+=dstepi)
+      norm +=( *(maskt++) = INTERPF(x));
+    norm = norm>0.0? 1.0/norm : dstepi;
+    maskt -= n;
+    for (i=n; i--;)
+      *(maskt++) *= norm;
+    }
+
+  pix12 = calloc((size_t)nx2*ny1, sizeof(float));
+  pixin0 = pix1+iys1a*w1;
+  pixout0 = pix12;
+  for (k=ny1; k--; pixin0+=w1, pixout0++)
+    {
+    maskt = mask;
+    nmaskt = nmask;
+    startt = start;
+    pixout = pixout0;
+    for (j=nx2; j--; pixout+=ny1)
+      {
+      pixin = pixin0+*(startt++);
+      val = 0.0;
+      for (i=*(nmaskt++); i--;)
+        val += *(maskt++)*(double)*(pixin++);
+      *pixout = (float)val;
+      }
+    }
+
+  y1 = ys1;
+  maskt = mask;
+  nmaskt = nmask;
+  startt = start;
+  for (j=ny2; j--; y1+=step2)
+    {
+    iy = (iy1=(int)y1) - hmh;
+    dym = (iy1 - y1 - hmh)*dstepi;
+    if (iy < 0)
+      {
+      n = interph+iy;
+      dym -= (double)iy*dstepi;
+      iy = 0;
+      }
+    else
+      n = interph;
+    if (n>(t=ny1-iy))
+      n=t;
+    *(startt++) = iy;
+    *(nmaskt++) = n;
+    norm = 0.0;
+    for (y=dym, i=n; i--; y+=dstepi)
+      norm += (*(maskt++) = INTERPF(y));
+    norm = norm>0.0? 1.0/norm : dstepi;
+    maskt -= n;
+    for (i=n; i--;)
+      *(maskt++) *= norm;
+    }
+
+  memset(pix2, 0, (size_t)(w2*h2)*sizeof(float));
+  pixin0 = pix12;
+  pixout0 = pix2+ixs2+iys2*w2;
+  for (k=nx2; k--; pixin0+=ny1, pixout0++)
+    {
+    maskt = mask;
+    nmaskt = nmask;
+    startt = start;
+    pixout = pixout0;
+    for (j=ny2; j--; pixout+=w2)
+      {
+      pixin = pixin0+*(startt++);
+      val = 0.0;
+      for (i=*(nmaskt++); i--;)
+        val += *(maskt++)*(double)*(pixin++);
+      *pixout = (float)val;
+      }
+    }
+
+  free(pix12);
+  free(mask);
+  free(nmask);
+  free(start);
+
+  return RETURN_OK;
+  }
+
+int	main(int argc, char **argv)
+  {
+   static const float	step2s[] = {1.667, 1.667, 1.0, 0.6},
+			stepis[] = {1.0, 0.7, 1.0, 0.7};
+   float		pix1[TEST_W1*TEST_W1], pix2[TEST_W2*TEST_W2],
+			ref[TEST_W2*TEST_W2];
+   double		*dx,*dy, err,errmax, peak, r2, ttab,tref;
+   clock_t		t;
+   int			c,i,n, nshift;
+
+  nshift = argc>1? atoi(argv[1]) : TEST_NSHIFT;
+  if (nshift<1)
+    nshift = 1;
+  for (i=0; i<TEST_W1*TEST_W1; i++)
+    {
+    r2 = (i%TEST_W1-TEST_W1/2)*(i%TEST_W1-TEST_W1/2)
+	+ (i/TEST_W1-TEST_W1/2)*(i/TEST_W1-TEST_W1/2);
+    pix1[i] = (float)(1000.0*exp(-r2/(2.0*2.5*2.5)) + test_rand() - 0.5);
+    }
+  dx = malloc(nshift*sizeof(double));
+  dy = malloc(nshift*sizeof(double));
+  for (n=0; n<nshift; n++)
+    {
+    dx[n] = 6.0*test_rand() - 3.0;
+    dy[n] = 6.0*test_rand() - 3.0;
+    }
+
+  printf(" step2  stepi  max.rel.error  analytic   tabulated\n");
+  for (c=0; c<4; c++)
+    {
+    errmax = 0.0;
+    for (n=0; n<nshift; n++)
+      {
+      if (test_resample_analytic(pix1, TEST_W1, TEST_W1, ref, TEST_W2,TEST_W2,
+		dx[n], dy[n], step2s[c], stepis[c]) != RETURN_OK
+	|| vignet_resample(pix1, TEST_W1, TEST_W1, pix2, TEST_W2, TEST_W2,
+		dx[n], dy[n], step2s[c], stepis[c]) != RETURN_OK)
+        {
+        test_nfail++;
+        continue;
+        }
+      peak = err = 0.0;
+      for (i=0; i<TEST_W2*TEST_W2; i++)
+        {
+        if (fabs(ref[i]) > peak)
+          peak = fabs(ref[i]);
+        if (!(fabs(pix2[i]-ref[i]) <= err))
+          err = fabs(pix2[i]-ref[i]);
+        }
+      if (!(err/peak <= errmax))
+        errmax = err/peak;
+      }
+    t = clock();
+    for (n=0; n<nshift; n++)
+      test_resample_analytic(pix1, TEST_W1, TEST_W1, ref, TEST_W2,TEST_W2,
+		dx[n], dy[n], step2s[c], stepis[c]);
+    tref = (double)(clock()-t)/CLOCKS_PER_SEC/nshift;
+    t = clock();
+    for (n=0; n<nshift; n++)
+      vignet_resample(pix1, TEST_W1, TEST_W1, pix2, TEST_W2,TEST_W2,
+		dx[n], dy[n], step2s[c], stepis[c]);
+    ttab = (double)(clock()-t)/CLOCKS_PER_SEC/nshift;
+    printf("%6.3f %6.2f %12.3g  %7.1f us  %7.1f us\n",
+	step2s[c], stepis[c], errmax, tref*1e6, ttab*1e6);
+    test_check(errmax, TEST_TOL);
+    }
+
+/* Integer shifts must give exact copies */
+  errmax = 0.0;
+  for (n=-3; n<=3; n++)
+    {
+    vignet_resample(pix1, TEST_W1, TEST_W1, pix2, TEST_W2, TEST_W2,
+		(double)n, (double)-n, 1.0, 1.0);
+    for (i=0; i<TEST_W2*TEST_W2; i++)
+      if (pix2[i] != pix1[(i/TEST_W2 + (TEST_W1-TEST_W2)/2 - n)*TEST_W1
+		+ i%TEST_W2 + (TEST_W1-TEST_W2)/2 + n])
+        errmax = 1.0;
+    }
+  printf("Integer shifts: %s\n", errmax>0.0? "NOT EXACT" : "exact copies");
+  test_check(errmax, 0.0);
+
+  free(dx);
+  free(dy);
+
+  return test_end();
+  }